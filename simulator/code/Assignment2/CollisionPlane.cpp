@@ -1,5 +1,4 @@
 #include "CollisionPlane.h"
-#include "Particle.h"
 #include<iostream>
 using namespace std;
 
@@ -8,20 +7,28 @@ CollisionPlane::CollisionPlane(P3D p, V3D n) {
     normal = n.normalized();
 }
 
-// If the given point is colliding with this plane, returns
-// the projection of that point onto this plane.
-// Otherwise, returns the same point.
-P3D CollisionPlane::handleCollision(Particle point)
+// If a particle moving from x_i to x_star is colliding with this plane, returns
+// the projection of x_star onto this plane.
+// Otherwise, returns x_star.
+template<typename Vector3>
+Vector3 CollisionPlane::handleCollision(const Vector3 &x_i, const Vector3 &x_star) const
 {
+    typedef typename Vector3::Scalar Scalar;
+    Vector3 planePoint = pointOnPlane.cast<Scalar>();
+    Vector3 planeNormal = normal.cast<Scalar>();
+
     // TODO: implement collision handling with planes.
-    V3D before = -pointOnPlane + point.x_i;
-    V3D after = -pointOnPlane + point.x_star;
-    if (before.dot(normal) * after.dot(normal) <= 0) {
+    Vector3 before = x_i - planePoint;
+    Vector3 after = x_star - planePoint;
+    if (before.dot(planeNormal) * after.dot(planeNormal) <= 0) {
         // Point collides with plane - return projection
-        double dist = after.dot(normal) * 2.0;
+        Scalar dist = after.dot(planeNormal) * 2;
         // cout << dist << '\n';
-        V3D corr = -(normal * dist);
-        return point.x_star + corr;
+        Vector3 corr = -(planeNormal * dist);
+        return x_star + corr;
     }
-    return point.x_star;
-}
\ No newline at end of file
+    return x_star;
+}
+
+template Eigen::Vector3f CollisionPlane::handleCollision(const Eigen::Vector3f &x_i, const Eigen::Vector3f &x_star) const;
+template Eigen::Vector3d CollisionPlane::handleCollision(const Eigen::Vector3d &x_i, const Eigen::Vector3d &x_star) const;
\ No newline at end of file
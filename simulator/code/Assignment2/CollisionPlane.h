@@ -2,7 +2,6 @@
 
 #include "MathLib/P3D.h"
 #include "MathLib/V3D.h"
-#include "Particle.h"
 
 class CollisionPlane {
 private:
@@ -10,5 +9,7 @@ private:
 	V3D normal;
 public:
 	CollisionPlane(P3D p, V3D n);
-	P3D handleCollision(Particle point);
+	// Defined for Eigen::Vector3f and Eigen::Vector3d, the positions of the float and double solvers.
+	template<typename Vector3>
+	Vector3 handleCollision(const Vector3 &x_i, const Vector3 &x_star) const;
 };
\ No newline at end of file
@@ -1,18 +1,52 @@
 #pragma once
 
-#define DELTA_T 0.008 //0.016
-#define SOLVER_ITERATIONS 10 //5
+// The physical parameters, the fixed time step and the solver iterations are in
+// SimulationParams.h, and are loaded from this file at startup
+#define SIMULATION_PARAMS_FILE "../data/simulation.params"
 
-#define KERNEL_H 0.25
-#define REST_DENSITY 10000000//450000
-#define CFM_EPSILON 0.1
-#define DRAG_COEFF 1
+// Adaptive time steps: a particle at the largest speed moves at most CFL_NUMBER * kernelH per
+// step, within [MIN_DELTA_T, MAX_DELTA_T], and a step is at most DELTA_T_MAX_GROWTH times the last
+#define FRAME_TIME (1. / 30.)
+#define CFL_NUMBER 0.4
+#define MIN_DELTA_T 0.002
+#define MAX_DELTA_T (FRAME_TIME / 2)
+#define DELTA_T_MAX_GROWTH 1.25
+// Over-relaxation factor of the SOR solver, and the plain iterations Chebyshev acceleration
+// estimates the spectral radius from (at least 2) and the largest radius it assumes
+#define SOR_FACTOR 1.5
+#define CHEBYSHEV_DELAY 3
+#define CHEBYSHEV_MAX_RADIUS 0.95
+// Cells of one color the Gauss-Seidel sweep hands out at once, and the colors (cell parities in 3D)
+#define GAUSS_SEIDEL_GRAIN 16
+#define GAUSS_SEIDEL_COLORS 8
+// Skin of the neighbor lists when a step is split into substeps. The particles usually move
+// further than half of it within a step, so the lists are rebuilt at most substeps.
+#define SUBSTEP_MARGIN 0.1
 
-#define TENSILE_DELTA_Q (0.2 * KERNEL_H)
-#define TENSILE_K 0.2
-#define TENSILE_N 4
+// Extra radius added to kernelH when building neighbor lists, so they can be reused
+// until some particle has moved more than half of it
+#define NEIGHBOR_SKIN 0.05
 
-#define VISCOSITY_C 0.01
-#define VORTICITY_EPSILON 0.0006
+// Number of steps between reorderings of the particles along a Morton curve (0 disables)
+#define REORDER_INTERVAL 60
 
-#define SPIKY_DAMPING 1
\ No newline at end of file
+// Fraction of particles that may change cells before the spatial map is rebuilt
+// from scratch instead of being patched
+#define MAX_CELL_CHURN 0.25
+
+// Smallest range of particles the tasks of a step are split into for idle threads to steal
+#define TASK_GRAIN 256
+
+// Precision of the simulation core. Define PBF_SINGLE_PRECISION to run the solver in float;
+// densities and constraint gradients are accumulated in double either way.
+#ifdef PBF_SINGLE_PRECISION
+#define PBF_SCALAR float
+#else
+#define PBF_SCALAR double
+#endif
+
+// Kernel family of the solver, one of the policies in SPHKernels.h: Poly6SpikyKernels (poly6
+// densities and spiky gradients, as in the PBF paper), CubicSplineKernels or WendlandC2Kernels.
+#ifndef PBF_KERNELS
+#define PBF_KERNELS Poly6SpikyKernels
+#endif
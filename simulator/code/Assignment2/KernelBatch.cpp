@@ -0,0 +1,181 @@
+#include "KernelBatch.h"
+#include <cmath>
+
+#ifdef KERNEL_BATCH_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+void evaluateKernelBatchSSE4(const KernelBatchCoefficients<float> &c, KernelBatch<float> &batch);
+void evaluateKernelBatchSSE4(const KernelBatchCoefficients<double> &c, KernelBatch<double> &batch);
+void evaluateKernelBatchAVX2(const KernelBatchCoefficients<float> &c, KernelBatch<float> &batch);
+void evaluateKernelBatchAVX2(const KernelBatchCoefficients<double> &c, KernelBatch<double> &batch);
+void evaluateKernelBatchAVX512(const KernelBatchCoefficients<float> &c, KernelBatch<float> &batch);
+void evaluateKernelBatchAVX512(const KernelBatchCoefficients<double> &c, KernelBatch<double> &batch);
+
+static void cpuid(int leaf, unsigned int regs[4]) {
+#ifdef _MSC_VER
+	__cpuidex((int*)regs, leaf, 0);
+#else
+	__cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// Register state the operating system saves on context switches (XCR0)
+static unsigned long long enabledRegisterState() {
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	unsigned int eax, edx;
+	__asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+
+static SimdLevel detectSimdLevel() {
+	unsigned int regs[4];
+	cpuid(0, regs);
+	unsigned int maxLeaf = regs[0];
+	if (maxLeaf < 1) return SIMD_SCALAR;
+
+	cpuid(1, regs);
+	bool sse41 = (regs[2] & (1 << 19)) != 0;
+	bool osxsave = (regs[2] & (1 << 27)) != 0;
+	bool avx = (regs[2] & (1 << 28)) != 0;
+	if (!sse41) return SIMD_SCALAR;
+	if (!osxsave || !avx || maxLeaf < 7) return SIMD_SSE4;
+
+	// The OS has to save the YMM (and for AVX-512, the ZMM and mask) registers
+	unsigned long long xcr0 = enabledRegisterState();
+	if ((xcr0 & 0x6) != 0x6) return SIMD_SSE4;
+
+	cpuid(7, regs);
+	bool avx2 = (regs[1] & (1 << 5)) != 0;
+	bool avx512f = (regs[1] & (1 << 16)) != 0;
+	if (!avx2) return SIMD_SSE4;
+	if (!avx512f || (xcr0 & 0xe6) != 0xe6) return SIMD_AVX2;
+	return SIMD_AVX512;
+}
+#else
+static SimdLevel detectSimdLevel() {
+	return SIMD_SCALAR;
+}
+#endif
+
+SimdLevel hostSimdLevel() {
+	static const SimdLevel level = detectSimdLevel();
+	return level;
+}
+
+const char* simdLevelName(SimdLevel level) {
+	switch (level) {
+	case SIMD_SSE4:
+		return "SSE4";
+	case SIMD_AVX2:
+		return "AVX2";
+	case SIMD_AVX512:
+		return "AVX-512";
+	default:
+		return "Scalar";
+	}
+}
+
+int simdLaneCount(SimdLevel level, int scalarSize) {
+	switch (level) {
+	case SIMD_SSE4:
+		return 16 / scalarSize;
+	case SIMD_AVX2:
+		return 32 / scalarSize;
+	case SIMD_AVX512:
+		return 64 / scalarSize;
+	default:
+		return 1;
+	}
+}
+
+const char* kernelFamilyName(KernelFamily family) {
+	switch (family) {
+	case CUBIC_SPLINE_KERNELS:
+		return "Cubic spline";
+	case WENDLAND_C2_KERNELS:
+		return "Wendland C2";
+	default:
+		return "Poly6/Spiky";
+	}
+}
+
+// Reference implementation, one lane at a time. Each family returns the kernel value w and the
+// factor t of the gradient grad W = r * t, and zero for both outside the support.
+template<typename Scalar>
+static void evaluateLaneScalar(const KernelBatchCoefficients<Scalar> &c, Scalar r2, Scalar len, Scalar &w, Scalar &t) {
+	bool inside = r2 < c.h2;
+	Scalar q = len * c.invH;
+	Scalar e = 1 - q;
+
+	switch (c.family) {
+	case CUBIC_SPLINE_KERNELS:
+		w = inside ? c.value * (0.5 < q ? 2 * e * e * e : 6 * (q * q * q - q * q) + 1) : 0;
+		t = inside ? c.gradient * (0.5 < q ? (q - 1) * e / q : 3 * q - 2) : 0;
+		break;
+	case WENDLAND_C2_KERNELS:
+		w = inside ? c.value * e * e * e * e * (1 + 4 * q) : 0;
+		t = inside ? c.gradient * e * e * e : 0;
+		break;
+	default: {
+		Scalar d = c.h2 - r2;
+		w = inside ? c.value * d * d * d : 0;
+		Scalar f = c.h - len;
+		t = inside && 0 < r2 ? c.gradient * f * f / len : 0;
+		break;
+	}
+	}
+}
+
+template<typename Scalar>
+static void evaluateKernelBatchScalar(const KernelBatchCoefficients<Scalar> &c, KernelBatch<Scalar> &batch) {
+	for (int k = 0; k < batch.padded; k++) {
+		Scalar rx = batch.rx[k], ry = batch.ry[k], rz = batch.rz[k];
+		Scalar r2 = rx * rx + ry * ry + rz * rz;
+		Scalar len = std::sqrt(r2);
+
+		Scalar t;
+		evaluateLaneScalar(c, r2, len, batch.w[k], t);
+		batch.gx[k] = rx * t;
+		batch.gy[k] = ry * t;
+		batch.gz[k] = rz * t;
+		batch.dist[k] = len;
+	}
+}
+
+template<typename Scalar>
+static void dispatchKernelBatch(SimdLevel level, const KernelBatchCoefficients<Scalar> &c, KernelBatch<Scalar> &batch) {
+	if (level > hostSimdLevel()) {
+		level = hostSimdLevel();
+	}
+	switch (level) {
+#ifdef KERNEL_BATCH_X86
+	case SIMD_SSE4:
+		evaluateKernelBatchSSE4(c, batch);
+		break;
+	case SIMD_AVX2:
+		evaluateKernelBatchAVX2(c, batch);
+		break;
+	case SIMD_AVX512:
+		evaluateKernelBatchAVX512(c, batch);
+		break;
+#endif
+	default:
+		evaluateKernelBatchScalar(c, batch);
+		break;
+	}
+}
+
+void evaluateKernelBatch(SimdLevel level, const KernelBatchCoefficients<float> &c, KernelBatch<float> &batch) {
+	dispatchKernelBatch(level, c, batch);
+}
+
+void evaluateKernelBatch(SimdLevel level, const KernelBatchCoefficients<double> &c, KernelBatch<double> &batch) {
+	dispatchKernelBatch(level, c, batch);
+}
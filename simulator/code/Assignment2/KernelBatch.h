@@ -0,0 +1,75 @@
+#pragma once
+
+// Kernel evaluation over blocks of neighbors, vectorized with whichever instruction set the
+// host supports. Each instruction set lives in its own KernelBatch<ISA>.cpp, compiled with the
+// flags for it, and is only called after the CPU has been checked to support it.
+
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#define KERNEL_BATCH_X86
+#endif
+
+// Most neighbors handed to the kernels at once. A multiple of the widest vector (16 floats).
+#define KERNEL_BATCH_SIZE 64
+#define KERNEL_BATCH_MAX_LANES 16
+
+enum SimdLevel {
+	SIMD_SCALAR,
+	SIMD_SSE4,
+	SIMD_AVX2,
+	SIMD_AVX512,
+	SIMD_LEVEL_COUNT
+};
+
+// Pairs of density and gradient kernels the solver can be compiled with (see SPHKernels.h).
+enum KernelFamily {
+	POLY6_SPIKY_KERNELS,
+	CUBIC_SPLINE_KERNELS,
+	WENDLAND_C2_KERNELS,
+	KERNEL_FAMILY_COUNT
+};
+
+/**
+ * Offsets r_j = x_i - x_j from one particle i to up to KERNEL_BATCH_SIZE of its neighbors, and
+ * the kernel terms evaluated for them: the density kernel value w, the gradient (gx, gy, gz) of
+ * the gradient kernel with respect to x_i, and the distance |r_j|. Neighbors outside the support get w = 0 and a zero
+ * gradient. Lanes count ... padded - 1 are padding, filled with zero offsets.
+ */
+template<typename Scalar>
+struct KernelBatch {
+	int count;
+	int padded;
+	Scalar rx[KERNEL_BATCH_SIZE];
+	Scalar ry[KERNEL_BATCH_SIZE];
+	Scalar rz[KERNEL_BATCH_SIZE];
+	Scalar w[KERNEL_BATCH_SIZE];
+	Scalar gx[KERNEL_BATCH_SIZE];
+	Scalar gy[KERNEL_BATCH_SIZE];
+	Scalar gz[KERNEL_BATCH_SIZE];
+	Scalar dist[KERNEL_BATCH_SIZE];
+};
+
+// The kernel constants of one family for support radius h, as computed by the kernel classes
+// in SPHKernels.h (see kernelBatchCoefficients there). W = value * f(r) and grad W = r * t(r),
+// where gradient is the constant factor of t.
+template<typename Scalar>
+struct KernelBatchCoefficients {
+	KernelFamily family;
+	Scalar h;
+	Scalar h2;
+	Scalar invH;
+	Scalar value;
+	Scalar gradient;
+};
+
+// The widest instruction set supported by both the CPU and the operating system.
+SimdLevel hostSimdLevel();
+const char* simdLevelName(SimdLevel level);
+const char* kernelFamilyName(KernelFamily family);
+// Number of lanes one instruction of the given level processes for float or double.
+int simdLaneCount(SimdLevel level, int scalarSize);
+
+// Fills w, gx, gy, gz and dist for lanes 0 ... padded - 1 of the batch, using the given
+// instruction set or the widest one the host supports if that is narrower. All levels do the
+// same operations in the same order, so SIMD_SCALAR can be used to verify the vector paths.
+void evaluateKernelBatch(SimdLevel level, const KernelBatchCoefficients<float> &c, KernelBatch<float> &batch);
+void evaluateKernelBatch(SimdLevel level, const KernelBatchCoefficients<double> &c, KernelBatch<double> &batch);
@@ -0,0 +1,68 @@
+#include "KernelBatch.h"
+
+// Compiled with AVX2 enabled (-mavx2). Nothing here may be called unless
+// hostSimdLevel() >= SIMD_AVX2.
+#ifdef KERNEL_BATCH_X86
+
+#include <immintrin.h>
+#include "KernelBatchSIMD.h"
+
+namespace {
+
+struct Avx2Float {
+	typedef float Scalar;
+	typedef __m256 Mask;
+	static const int Lanes = 8;
+	__m256 v;
+
+	Avx2Float(__m256 v) : v(v) {}
+	static Avx2Float set1(float x) { return _mm256_set1_ps(x); }
+	static Avx2Float load(const float *p) { return _mm256_loadu_ps(p); }
+	void store(float *p) const { _mm256_storeu_ps(p, v); }
+
+	friend Avx2Float operator+(Avx2Float a, Avx2Float b) { return _mm256_add_ps(a.v, b.v); }
+	friend Avx2Float operator-(Avx2Float a, Avx2Float b) { return _mm256_sub_ps(a.v, b.v); }
+	friend Avx2Float operator*(Avx2Float a, Avx2Float b) { return _mm256_mul_ps(a.v, b.v); }
+	friend Avx2Float operator/(Avx2Float a, Avx2Float b) { return _mm256_div_ps(a.v, b.v); }
+	static Avx2Float sqrt(Avx2Float a) { return _mm256_sqrt_ps(a.v); }
+
+	static Mask less(Avx2Float a, Avx2Float b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+	static Mask both(Mask a, Mask b) { return _mm256_and_ps(a, b); }
+	static Avx2Float keep(Mask m, Avx2Float a) { return _mm256_blendv_ps(_mm256_setzero_ps(), a.v, m); }
+	static Avx2Float select(Mask m, Avx2Float a, Avx2Float b) { return _mm256_blendv_ps(b.v, a.v, m); }
+};
+
+struct Avx2Double {
+	typedef double Scalar;
+	typedef __m256d Mask;
+	static const int Lanes = 4;
+	__m256d v;
+
+	Avx2Double(__m256d v) : v(v) {}
+	static Avx2Double set1(double x) { return _mm256_set1_pd(x); }
+	static Avx2Double load(const double *p) { return _mm256_loadu_pd(p); }
+	void store(double *p) const { _mm256_storeu_pd(p, v); }
+
+	friend Avx2Double operator+(Avx2Double a, Avx2Double b) { return _mm256_add_pd(a.v, b.v); }
+	friend Avx2Double operator-(Avx2Double a, Avx2Double b) { return _mm256_sub_pd(a.v, b.v); }
+	friend Avx2Double operator*(Avx2Double a, Avx2Double b) { return _mm256_mul_pd(a.v, b.v); }
+	friend Avx2Double operator/(Avx2Double a, Avx2Double b) { return _mm256_div_pd(a.v, b.v); }
+	static Avx2Double sqrt(Avx2Double a) { return _mm256_sqrt_pd(a.v); }
+
+	static Mask less(Avx2Double a, Avx2Double b) { return _mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ); }
+	static Mask both(Mask a, Mask b) { return _mm256_and_pd(a, b); }
+	static Avx2Double keep(Mask m, Avx2Double a) { return _mm256_blendv_pd(_mm256_setzero_pd(), a.v, m); }
+	static Avx2Double select(Mask m, Avx2Double a, Avx2Double b) { return _mm256_blendv_pd(b.v, a.v, m); }
+};
+
+}
+
+void evaluateKernelBatchAVX2(const KernelBatchCoefficients<float> &c, KernelBatch<float> &batch) {
+	evaluateKernelLanes<Avx2Float>(c, batch);
+}
+
+void evaluateKernelBatchAVX2(const KernelBatchCoefficients<double> &c, KernelBatch<double> &batch) {
+	evaluateKernelLanes<Avx2Double>(c, batch);
+}
+
+#endif
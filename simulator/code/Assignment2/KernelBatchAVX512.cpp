@@ -0,0 +1,73 @@
+#include "KernelBatch.h"
+
+// Compiled with AVX-512F enabled (-mavx512f). Nothing here may be called unless
+// hostSimdLevel() >= SIMD_AVX512.
+#ifdef KERNEL_BATCH_X86
+
+#include <immintrin.h>
+#include "KernelBatchSIMD.h"
+
+// GCC takes the undefined source operand of _mm512_sqrt_ps/pd for a use of an uninitialized value
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+namespace {
+
+struct Avx512Float {
+	typedef float Scalar;
+	typedef __mmask16 Mask;
+	static const int Lanes = 16;
+	__m512 v;
+
+	Avx512Float(__m512 v) : v(v) {}
+	static Avx512Float set1(float x) { return _mm512_set1_ps(x); }
+	static Avx512Float load(const float *p) { return _mm512_loadu_ps(p); }
+	void store(float *p) const { _mm512_storeu_ps(p, v); }
+
+	friend Avx512Float operator+(Avx512Float a, Avx512Float b) { return _mm512_add_ps(a.v, b.v); }
+	friend Avx512Float operator-(Avx512Float a, Avx512Float b) { return _mm512_sub_ps(a.v, b.v); }
+	friend Avx512Float operator*(Avx512Float a, Avx512Float b) { return _mm512_mul_ps(a.v, b.v); }
+	friend Avx512Float operator/(Avx512Float a, Avx512Float b) { return _mm512_div_ps(a.v, b.v); }
+	static Avx512Float sqrt(Avx512Float a) { return _mm512_sqrt_ps(a.v); }
+
+	static Mask less(Avx512Float a, Avx512Float b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ); }
+	static Mask both(Mask a, Mask b) { return a & b; }
+	static Avx512Float keep(Mask m, Avx512Float a) { return _mm512_maskz_mov_ps(m, a.v); }
+	static Avx512Float select(Mask m, Avx512Float a, Avx512Float b) { return _mm512_mask_mov_ps(b.v, m, a.v); }
+};
+
+struct Avx512Double {
+	typedef double Scalar;
+	typedef __mmask8 Mask;
+	static const int Lanes = 8;
+	__m512d v;
+
+	Avx512Double(__m512d v) : v(v) {}
+	static Avx512Double set1(double x) { return _mm512_set1_pd(x); }
+	static Avx512Double load(const double *p) { return _mm512_loadu_pd(p); }
+	void store(double *p) const { _mm512_storeu_pd(p, v); }
+
+	friend Avx512Double operator+(Avx512Double a, Avx512Double b) { return _mm512_add_pd(a.v, b.v); }
+	friend Avx512Double operator-(Avx512Double a, Avx512Double b) { return _mm512_sub_pd(a.v, b.v); }
+	friend Avx512Double operator*(Avx512Double a, Avx512Double b) { return _mm512_mul_pd(a.v, b.v); }
+	friend Avx512Double operator/(Avx512Double a, Avx512Double b) { return _mm512_div_pd(a.v, b.v); }
+	static Avx512Double sqrt(Avx512Double a) { return _mm512_sqrt_pd(a.v); }
+
+	static Mask less(Avx512Double a, Avx512Double b) { return _mm512_cmp_pd_mask(a.v, b.v, _CMP_LT_OQ); }
+	static Mask both(Mask a, Mask b) { return a & b; }
+	static Avx512Double keep(Mask m, Avx512Double a) { return _mm512_maskz_mov_pd(m, a.v); }
+	static Avx512Double select(Mask m, Avx512Double a, Avx512Double b) { return _mm512_mask_mov_pd(b.v, m, a.v); }
+};
+
+}
+
+void evaluateKernelBatchAVX512(const KernelBatchCoefficients<float> &c, KernelBatch<float> &batch) {
+	evaluateKernelLanes<Avx512Float>(c, batch);
+}
+
+void evaluateKernelBatchAVX512(const KernelBatchCoefficients<double> &c, KernelBatch<double> &batch) {
+	evaluateKernelLanes<Avx512Double>(c, batch);
+}
+
+#endif
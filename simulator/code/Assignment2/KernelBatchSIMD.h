@@ -0,0 +1,108 @@
+#pragma once
+
+#include "KernelBatch.h"
+
+// Kernel evaluation written against a small vector type V, which wraps the registers of one
+// instruction set: V::Scalar and V::Lanes, arithmetic operators, sqrt, and masks from
+// less() combined with both() that keep() and select() apply. Only the KernelBatch<ISA>.cpp
+// files include this, after defining V for their instruction set. The operations and their
+// order match the scalar reference in KernelBatch.cpp. Batch arrays are not assumed to be aligned.
+
+// Each family computes the kernel value w and the factor t of its gradient grad W = r * t from
+// |r|^2 and |r|, for the lanes inside the support, and returns zero in every other lane.
+template<typename V>
+struct Poly6SpikyLanes {
+	V h, h2, value, gradient, zero;
+
+	explicit Poly6SpikyLanes(const KernelBatchCoefficients<typename V::Scalar> &c)
+		: h(V::set1(c.h)), h2(V::set1(c.h2)), value(V::set1(c.value)), gradient(V::set1(c.gradient)), zero(V::set1(0)) {}
+
+	V w(V r2, V /*len*/, typename V::Mask inside) const {
+		V d = h2 - r2;
+		return V::keep(inside, value * d * d * d);
+	}
+
+	V t(V r2, V len, typename V::Mask inside) const {
+		V e = h - len;
+		return V::keep(V::both(inside, V::less(zero, r2)), gradient * e * e / len);
+	}
+};
+
+template<typename V>
+struct CubicSplineLanes {
+	V invH, value, gradient, half, one, two, three, six;
+
+	explicit CubicSplineLanes(const KernelBatchCoefficients<typename V::Scalar> &c)
+		: invH(V::set1(c.invH)), value(V::set1(c.value)), gradient(V::set1(c.gradient)),
+		  half(V::set1(0.5)), one(V::set1(1)), two(V::set1(2)), three(V::set1(3)), six(V::set1(6)) {}
+
+	V w(V /*r2*/, V len, typename V::Mask inside) const {
+		V q = len * invH;
+		V e = one - q;
+		return V::keep(inside, value * V::select(V::less(half, q), two * e * e * e, six * (q * q * q - q * q) + one));
+	}
+
+	// The outer piece divides by q, and is only selected where q > 1/2
+	V t(V /*r2*/, V len, typename V::Mask inside) const {
+		V q = len * invH;
+		V e = one - q;
+		return V::keep(inside, gradient * V::select(V::less(half, q), (q - one) * e / q, three * q - two));
+	}
+};
+
+template<typename V>
+struct WendlandC2Lanes {
+	V invH, value, gradient, one, four;
+
+	explicit WendlandC2Lanes(const KernelBatchCoefficients<typename V::Scalar> &c)
+		: invH(V::set1(c.invH)), value(V::set1(c.value)), gradient(V::set1(c.gradient)), one(V::set1(1)), four(V::set1(4)) {}
+
+	V w(V /*r2*/, V len, typename V::Mask inside) const {
+		V q = len * invH;
+		V e = one - q;
+		return V::keep(inside, value * e * e * e * e * (one + four * q));
+	}
+
+	V t(V /*r2*/, V len, typename V::Mask inside) const {
+		V e = one - len * invH;
+		return V::keep(inside, gradient * e * e * e);
+	}
+};
+
+template<typename V, typename Family>
+void evaluateFamilyLanes(const KernelBatchCoefficients<typename V::Scalar> &c, KernelBatch<typename V::Scalar> &batch) {
+	const Family family(c);
+	const V h2 = V::set1(c.h2);
+
+	for (int k = 0; k < batch.padded; k += V::Lanes) {
+		V rx = V::load(batch.rx + k);
+		V ry = V::load(batch.ry + k);
+		V rz = V::load(batch.rz + k);
+		V r2 = rx * rx + ry * ry + rz * rz;
+		V len = V::sqrt(r2);
+		typename V::Mask inside = V::less(r2, h2);
+		V w = family.w(r2, len, inside);
+		V t = family.t(r2, len, inside);
+
+		w.store(batch.w + k);
+		(rx * t).store(batch.gx + k);
+		(ry * t).store(batch.gy + k);
+		(rz * t).store(batch.gz + k);
+		len.store(batch.dist + k);
+	}
+}
+
+template<typename V>
+void evaluateKernelLanes(const KernelBatchCoefficients<typename V::Scalar> &c, KernelBatch<typename V::Scalar> &batch) {
+	switch (c.family) {
+	case CUBIC_SPLINE_KERNELS:
+		evaluateFamilyLanes<V, CubicSplineLanes<V> >(c, batch);
+		break;
+	case WENDLAND_C2_KERNELS:
+		evaluateFamilyLanes<V, WendlandC2Lanes<V> >(c, batch);
+		break;
+	default:
+		evaluateFamilyLanes<V, Poly6SpikyLanes<V> >(c, batch);
+		break;
+	}
+}
@@ -0,0 +1,68 @@
+#include "KernelBatch.h"
+
+// Compiled with SSE4.1 enabled (-msse4.1). Nothing here may be called unless
+// hostSimdLevel() >= SIMD_SSE4.
+#ifdef KERNEL_BATCH_X86
+
+#include <smmintrin.h>
+#include "KernelBatchSIMD.h"
+
+namespace {
+
+struct Sse4Float {
+	typedef float Scalar;
+	typedef __m128 Mask;
+	static const int Lanes = 4;
+	__m128 v;
+
+	Sse4Float(__m128 v) : v(v) {}
+	static Sse4Float set1(float x) { return _mm_set1_ps(x); }
+	static Sse4Float load(const float *p) { return _mm_loadu_ps(p); }
+	void store(float *p) const { _mm_storeu_ps(p, v); }
+
+	friend Sse4Float operator+(Sse4Float a, Sse4Float b) { return _mm_add_ps(a.v, b.v); }
+	friend Sse4Float operator-(Sse4Float a, Sse4Float b) { return _mm_sub_ps(a.v, b.v); }
+	friend Sse4Float operator*(Sse4Float a, Sse4Float b) { return _mm_mul_ps(a.v, b.v); }
+	friend Sse4Float operator/(Sse4Float a, Sse4Float b) { return _mm_div_ps(a.v, b.v); }
+	static Sse4Float sqrt(Sse4Float a) { return _mm_sqrt_ps(a.v); }
+
+	static Mask less(Sse4Float a, Sse4Float b) { return _mm_cmplt_ps(a.v, b.v); }
+	static Mask both(Mask a, Mask b) { return _mm_and_ps(a, b); }
+	static Sse4Float keep(Mask m, Sse4Float a) { return _mm_blendv_ps(_mm_setzero_ps(), a.v, m); }
+	static Sse4Float select(Mask m, Sse4Float a, Sse4Float b) { return _mm_blendv_ps(b.v, a.v, m); }
+};
+
+struct Sse4Double {
+	typedef double Scalar;
+	typedef __m128d Mask;
+	static const int Lanes = 2;
+	__m128d v;
+
+	Sse4Double(__m128d v) : v(v) {}
+	static Sse4Double set1(double x) { return _mm_set1_pd(x); }
+	static Sse4Double load(const double *p) { return _mm_loadu_pd(p); }
+	void store(double *p) const { _mm_storeu_pd(p, v); }
+
+	friend Sse4Double operator+(Sse4Double a, Sse4Double b) { return _mm_add_pd(a.v, b.v); }
+	friend Sse4Double operator-(Sse4Double a, Sse4Double b) { return _mm_sub_pd(a.v, b.v); }
+	friend Sse4Double operator*(Sse4Double a, Sse4Double b) { return _mm_mul_pd(a.v, b.v); }
+	friend Sse4Double operator/(Sse4Double a, Sse4Double b) { return _mm_div_pd(a.v, b.v); }
+	static Sse4Double sqrt(Sse4Double a) { return _mm_sqrt_pd(a.v); }
+
+	static Mask less(Sse4Double a, Sse4Double b) { return _mm_cmplt_pd(a.v, b.v); }
+	static Mask both(Mask a, Mask b) { return _mm_and_pd(a, b); }
+	static Sse4Double keep(Mask m, Sse4Double a) { return _mm_blendv_pd(_mm_setzero_pd(), a.v, m); }
+	static Sse4Double select(Mask m, Sse4Double a, Sse4Double b) { return _mm_blendv_pd(b.v, a.v, m); }
+};
+
+}
+
+void evaluateKernelBatchSSE4(const KernelBatchCoefficients<float> &c, KernelBatch<float> &batch) {
+	evaluateKernelLanes<Sse4Float>(c, batch);
+}
+
+void evaluateKernelBatchSSE4(const KernelBatchCoefficients<double> &c, KernelBatch<double> &batch) {
+	evaluateKernelLanes<Sse4Double>(c, batch);
+}
+
+#endif
@@ -0,0 +1,143 @@
+#include "KernelBenchmark.h"
+#include "SPHKernels.h"
+#include "UniformGrid.h"
+#include "NeighborList.h"
+#include "Constants.h"
+#include "SimulationParams.h"
+#include "Utils/Logger.h"
+#include "Utils/Timer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+using namespace std;
+
+typedef PBF_SCALAR BenchmarkScalar;
+// Kernel radius of the benchmarks, the default one of the simulation
+const double BENCHMARK_RADIUS = SimulationParams().kernelH;
+
+static double randomUnit() {
+	return (double)rand() / RAND_MAX;
+}
+
+static vector<KernelBatchCoefficients<BenchmarkScalar>> allKernelFamilies() {
+	vector<KernelBatchCoefficients<BenchmarkScalar>> families;
+	families.push_back(kernelBatchCoefficients<Poly6SpikyKernels, BenchmarkScalar>(BENCHMARK_RADIUS));
+	families.push_back(kernelBatchCoefficients<CubicSplineKernels, BenchmarkScalar>(BENCHMARK_RADIUS));
+	families.push_back(kernelBatchCoefficients<WendlandC2Kernels, BenchmarkScalar>(BENCHMARK_RADIUS));
+	return families;
+}
+
+// Sums the density kernel over the neighbor list of every particle, evaluated in batches the
+// way the solver does. Lists include the particle itself, which accounts for W(0).
+static void sumDensities(const KernelBatchCoefficients<BenchmarkScalar> &c, SimdLevel level, const PositionArray &x,
+	const NeighborList &neighbors, KernelBatch<BenchmarkScalar> &batch, vector<double> &density) {
+	for (int i = 0; i < (int)x.size(); i++) {
+		double sum = 0;
+		int p = neighbors.offsets[i];
+		int end = neighbors.offsets[i + 1];
+		while (p != end) {
+			int count = min(end - p, KERNEL_BATCH_SIZE);
+			batch.count = count;
+			batch.padded = (count + KERNEL_BATCH_MAX_LANES - 1) / KERNEL_BATCH_MAX_LANES * KERNEL_BATCH_MAX_LANES;
+			for (int k = 0; k < count; k++) {
+				V3D r = x[i] - x[neighbors.indices[p + k]];
+				batch.rx[k] = (BenchmarkScalar)r[0];
+				batch.ry[k] = (BenchmarkScalar)r[1];
+				batch.rz[k] = (BenchmarkScalar)r[2];
+			}
+			for (int k = count; k < batch.padded; k++) {
+				batch.rx[k] = batch.ry[k] = batch.rz[k] = 0;
+			}
+
+			evaluateKernelBatch(level, c, batch);
+			for (int k = 0; k < count; k++) {
+				sum += batch.w[k];
+			}
+			p += count;
+		}
+		density[i] = sum;
+	}
+}
+
+vector<KernelBenchmarkResult> benchmarkKernelFamilies(double supportRatio, int n, double jitter, SimdLevel level, int repeats) {
+	double spacing = BENCHMARK_RADIUS / supportRatio;
+	int perSide = max(1, (int)round(cbrt((double)n)));
+	double side = perSide * spacing;
+
+	srand(467);
+	PositionArray x;
+	for (int a = 0; a < perSide; a++) {
+		for (int b = 0; b < perSide; b++) {
+			for (int c = 0; c < perSide; c++) {
+				P3D lattice((a + 0.5) * spacing, (b + 0.5) * spacing, (c + 0.5) * spacing);
+				V3D offset(2 * randomUnit() - 1, 2 * randomUnit() - 1, 2 * randomUnit() - 1);
+				x.push_back(lattice + offset * (jitter * spacing));
+			}
+		}
+	}
+
+	UniformGrid grid(BENCHMARK_RADIUS, P3D(-spacing, -spacing, -spacing), P3D(side + spacing, side + spacing, side + spacing));
+	grid.rebuildAll(x);
+	NeighborList neighbors;
+	neighbors.build(x.size(), [&](int i, vector<int> &out) {
+		grid.findNeighbors(i, x, out);
+	});
+
+	// Only particles with a full neighborhood are compared against the density of the lattice
+	vector<int> interior;
+	double interiorNeighbors = 0;
+	for (int i = 0; i < (int)x.size(); i++) {
+		bool inside = true;
+		for (int axis = 0; axis < 3; axis++) {
+			inside = inside && x[i][axis] > BENCHMARK_RADIUS && x[i][axis] < side - BENCHMARK_RADIUS;
+		}
+		if (inside) {
+			interior.push_back(i);
+			interiorNeighbors += neighbors.offsets[i + 1] - neighbors.offsets[i];
+		}
+	}
+	double restDensity = 1 / (spacing * spacing * spacing);
+
+	KernelBatch<BenchmarkScalar> batch;
+	vector<double> density(x.size());
+	vector<KernelBenchmarkResult> results;
+	for (const KernelBatchCoefficients<BenchmarkScalar> &c : allKernelFamilies()) {
+		KernelBenchmarkResult result;
+		result.family = kernelFamilyName(c.family);
+		result.supportRatio = supportRatio;
+		result.neighbors = interior.empty() ? 0 : interiorNeighbors / interior.size();
+		result.particles = x.size();
+		result.evaluateTime = 1e30;
+		for (int r = 0; r < max(repeats, 1); r++) {
+			Timer timer;
+			sumDensities(c, level, x, neighbors, batch, density);
+			result.evaluateTime = min(result.evaluateTime, timer.timeEllapsed() * 1000);
+		}
+		result.pairTime = neighbors.pairCount() > 0 ? result.evaluateTime * 1e6 / neighbors.pairCount() : 0;
+
+		double sum = 0, sumSquares = 0, largest = 0;
+		for (int i : interior) {
+			double error = density[i] / restDensity - 1;
+			sum += error;
+			sumSquares += error * error;
+			largest = max(largest, fabs(error));
+		}
+		result.densityBias = interior.empty() ? 0 : sum / interior.size();
+		result.densityError = interior.empty() ? 0 : sqrt(sumSquares / interior.size());
+		result.maxDensityError = largest;
+		results.push_back(result);
+	}
+	return results;
+}
+
+void runKernelBenchmark(const vector<double> &supportRatios) {
+	for (double ratio : supportRatios) {
+		Logger::consolePrint("Kernel benchmark: kernelH = %.2f spacings, 20^3 particles jittered by 0.1 spacings\n", ratio);
+
+		for (const KernelBenchmarkResult &r : benchmarkKernelFamilies(ratio, 8000, 0.1, hostSimdLevel())) {
+			Logger::consolePrint("  %-12s %5.1f neighbors  %7.2f ms (%5.2f ns/pair)  density error: bias %+7.3f%%  rms %6.3f%%  max %6.3f%%\n",
+				r.family.c_str(), r.neighbors, r.evaluateTime, r.pairTime, 100 * r.densityBias, 100 * r.densityError, 100 * r.maxDensityError);
+		}
+	}
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "KernelBatch.h"
+#include <vector>
+#include <string>
+
+// Cost and accuracy of one kernel family on one jittered lattice.
+struct KernelBenchmarkResult {
+	std::string family;
+	// kernelH in units of the lattice spacing, and the resulting number of particles within
+	// kernelH of a particle (itself included), averaged over the interior particles
+	double supportRatio;
+	double neighbors;
+	int particles;
+	// Time to evaluate the kernels of every pair once (in milliseconds, the best of the repeats)
+	// and per pair (in nanoseconds)
+	double evaluateTime;
+	double pairTime;
+	// Relative error rho / rho_0 - 1 of the SPH density against the density of the lattice,
+	// over the particles at least kernelH away from its faces: the mean, the root mean
+	// square, and the largest magnitude
+	double densityBias;
+	double densityError;
+	double maxDensityError;
+};
+
+// Evaluates the kernels of every family on a lattice of about n particles with spacing
+// kernelH / supportRatio, each displaced by up to jitter spacings along every axis, using
+// the given instruction set. Densities are summed over the neighbor lists the same way the
+// solver does, with unit masses.
+std::vector<KernelBenchmarkResult> benchmarkKernelFamilies(double supportRatio, int n, double jitter, SimdLevel level, int repeats = 1);
+
+// Runs the benchmark for the given support ratios and prints the results to the console.
+void runKernelBenchmark(const std::vector<double> &supportRatios);
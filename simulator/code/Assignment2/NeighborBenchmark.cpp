@@ -0,0 +1,247 @@
+#include "NeighborBenchmark.h"
+#include "SpatialMap.h"
+#include "UniformGrid.h"
+#include "SpatialHash.h"
+#include "NeighborList.h"
+#include "Constants.h"
+#include "SimulationParams.h"
+#include "Utils/Logger.h"
+#include "Utils/Timer.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+#include <cstdlib>
+
+using namespace std;
+
+// Kernel radius of the benchmarks, the default one of the simulation
+const double BENCHMARK_RADIUS = SimulationParams().kernelH;
+// Average number of neighbors per particle in the generated clouds, close to what
+// the bunny scenes settle to. The cloud grows with the particle count to keep this fixed.
+const double BENCHMARK_NEIGHBORS = 30;
+// Particles per cluster in the clustered clouds
+const int BENCHMARK_CLUSTER_SIZE = 2000;
+
+static double cloudSide(int n) {
+	return BENCHMARK_RADIUS * cbrt(n * (4.0 / 3.0) * PI / BENCHMARK_NEIGHBORS);
+}
+
+static double randomUnit() {
+	return (double)rand() / RAND_MAX;
+}
+
+// Recomputes the bounding box of the cloud from its positions.
+static void fitBounds(BenchmarkCloud &cloud) {
+	if (cloud.positions.empty()) {
+		cloud.minCorner = cloud.maxCorner = P3D(0, 0, 0);
+		return;
+	}
+	cloud.minCorner = cloud.maxCorner = cloud.positions[0];
+	for (const P3D &x : cloud.positions) {
+		for (int axis = 0; axis < 3; axis++) {
+			cloud.minCorner[axis] = min(cloud.minCorner[axis], x[axis]);
+			cloud.maxCorner[axis] = max(cloud.maxCorner[axis], x[axis]);
+		}
+	}
+}
+
+BenchmarkCloud makeUniformCloud(int n) {
+	double side = cloudSide(n);
+
+	srand(467);
+	BenchmarkCloud cloud;
+	cloud.name = "uniform";
+	cloud.positions.resize(n);
+	for (auto &x : cloud.positions) {
+		x = P3D(side * randomUnit(), side * randomUnit(), side * randomUnit());
+	}
+	cloud.minCorner = P3D(0, 0, 0);
+	cloud.maxCorner = P3D(side, side, side);
+	return cloud;
+}
+
+BenchmarkCloud makeClusteredCloud(int n) {
+	double side = cloudSide(n);
+	int clusterCount = max(1, n / BENCHMARK_CLUSTER_SIZE);
+	// Clusters as wide as a uniform cloud of a tenth of their size, so ten times denser
+	double sigma = 0.5 * cloudSide(BENCHMARK_CLUSTER_SIZE / 10);
+
+	srand(467);
+	vector<P3D> centers(clusterCount);
+	for (auto &c : centers) {
+		c = P3D(side * randomUnit(), side * randomUnit(), side * randomUnit());
+	}
+
+	BenchmarkCloud cloud;
+	cloud.name = "clustered";
+	cloud.positions.resize(n);
+	for (int i = 0; i < n; i++) {
+		P3D x = centers[i % clusterCount];
+		for (int axis = 0; axis < 3; axis++) {
+			// Box-Muller transform
+			double u = max(randomUnit(), 1e-12);
+			x[axis] += sigma * sqrt(-2 * log(u)) * cos(2 * PI * randomUnit());
+		}
+		cloud.positions[i] = x;
+	}
+	fitBounds(cloud);
+	return cloud;
+}
+
+BenchmarkCloud makeMeshCloud(const string &path, int n) {
+	vector<P3D> vertices;
+	ifstream file(path.c_str());
+	string line;
+	while (getline(file, line)) {
+		if (line.size() > 2 && line[0] == 'v' && line[1] == ' ') {
+			istringstream values(line.substr(2));
+			double x, y, z;
+			values >> x >> y >> z;
+			vertices.push_back(P3D(x, y, z));
+		}
+	}
+
+	BenchmarkCloud cloud;
+	cloud.name = path.substr(path.find_last_of("/\\") + 1);
+	cloud.positions.assign(vertices.begin(), vertices.end());
+	fitBounds(cloud);
+	if (n <= 0 || vertices.empty()) {
+		return cloud;
+	}
+
+	// Tile copies of the mesh on a cubic lattice, one kernel radius apart
+	V3D extent = cloud.maxCorner - cloud.minCorner;
+	int copies = (n + vertices.size() - 1) / vertices.size();
+	int perSide = (int)ceil(cbrt((double)copies));
+	cloud.positions.resize(n);
+	for (int i = 0; i < n; i++) {
+		int copy = i / vertices.size();
+		V3D offset((copy % perSide) * (extent[0] + BENCHMARK_RADIUS), (copy / perSide % perSide) * (extent[1] + BENCHMARK_RADIUS),
+			(copy / (perSide * perSide)) * (extent[2] + BENCHMARK_RADIUS));
+		cloud.positions[i] = vertices[i % vertices.size()] + offset;
+	}
+	fitBounds(cloud);
+	return cloud;
+}
+
+// The backends are owned by the caller.
+static NeighborSearch* createBackend(NeighborBackend backend, const BenchmarkCloud &cloud) {
+	switch (backend) {
+	case SPATIAL_MAP_BACKEND:
+		return new SpatialMap(BENCHMARK_RADIUS);
+	case UNIFORM_GRID_BACKEND:
+		return new UniformGrid(BENCHMARK_RADIUS, cloud.minCorner, cloud.maxCorner);
+	default:
+		return new SpatialHash(BENCHMARK_RADIUS);
+	}
+}
+
+static const char* backendName(NeighborBackend backend) {
+	switch (backend) {
+	case SPATIAL_MAP_BACKEND:
+		return "SpatialMap";
+	case UNIFORM_GRID_BACKEND:
+		return "UniformGrid";
+	default:
+		return "SpatialHash";
+	}
+}
+
+static void bruteForceNeighbors(int i, const PositionArray &x_star, vector<int> &out) {
+	for (int j = 0; j < (int)x_star.size(); j++) {
+		V3D diff = x_star[i] - x_star[j];
+		if (diff.length2() < BENCHMARK_RADIUS * BENCHMARK_RADIUS) {
+			out.push_back(j);
+		}
+	}
+}
+
+// Returns true if the full list of i matches brute force, and its half list only holds
+// distinct true neighbors other than i.
+static bool verifyParticle(int i, const PositionArray &x_star, const NeighborList &full, const NeighborList &half) {
+	vector<int> expected;
+	bruteForceNeighbors(i, x_star, expected);
+
+	vector<int> found(full.begin(i), full.end(i));
+	sort(found.begin(), found.end());
+	if (found != expected) {
+		return false;
+	}
+
+	vector<int> halfFound(half.begin(i), half.end(i));
+	sort(halfFound.begin(), halfFound.end());
+	if (adjacent_find(halfFound.begin(), halfFound.end()) != halfFound.end()) {
+		return false;
+	}
+	for (int j : halfFound) {
+		if (j == i || !binary_search(expected.begin(), expected.end(), j)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+vector<NeighborBenchmarkResult> benchmarkNeighborBackends(const BenchmarkCloud &cloud, int verifyCount, int repeats) {
+	const PositionArray &x_star = cloud.positions;
+	int n = x_star.size();
+	vector<NeighborBenchmarkResult> results;
+
+	for (int b = 0; b < NEIGHBOR_BACKEND_COUNT; b++) {
+		NeighborSearch *search = createBackend((NeighborBackend)b, cloud);
+		NeighborBenchmarkResult result;
+		result.backend = backendName((NeighborBackend)b);
+		result.buildTime = result.queryTime = result.halfQueryTime = 1e30;
+
+		NeighborList full, half;
+		for (int r = 0; r < max(repeats, 1); r++) {
+			Timer timer;
+			search->rebuildAll(x_star);
+			result.buildTime = min(result.buildTime, timer.timeEllapsed() * 1000);
+
+			timer.restart();
+			full.build(n, [&](int i, vector<int> &out) {
+				search->findNeighbors(i, x_star, out);
+			});
+			result.queryTime = min(result.queryTime, timer.timeEllapsed() * 1000);
+
+			timer.restart();
+			half.build(n, [&](int i, vector<int> &out) {
+				search->findHalfNeighbors(i, x_star, out);
+			});
+			result.halfQueryTime = min(result.halfQueryTime, timer.timeEllapsed() * 1000);
+		}
+		result.pairs = full.pairCount();
+		result.halfPairs = half.pairCount();
+
+		result.checkedParticles = min(verifyCount, n);
+		result.mismatches = 0;
+		for (int k = 0; k < result.checkedParticles; k++) {
+			int i = (int)((long long)n * k / result.checkedParticles);
+			if (!verifyParticle(i, x_star, full, half)) {
+				result.mismatches++;
+			}
+		}
+		// Every pair must be reported exactly once by the half lists
+		if (result.checkedParticles > 0 && 2 * result.halfPairs != result.pairs - n) {
+			result.mismatches++;
+		}
+
+		delete search;
+		results.push_back(result);
+	}
+	return results;
+}
+
+void runNeighborBenchmark(const vector<int> &sizes) {
+	for (int n : sizes) {
+		BenchmarkCloud cloud = makeUniformCloud(n);
+		Logger::consolePrint("Neighbor benchmark: %d particles in a %.2f^3 box\n", n, cloud.maxCorner[0]);
+
+		for (const NeighborBenchmarkResult &r : benchmarkNeighborBackends(cloud, 100)) {
+			Logger::consolePrint("  %-12s build %9.2f ms  query %9.2f ms  half %9.2f ms  (%.1f neighbors/particle)%s\n",
+				r.backend.c_str(), r.buildTime, r.queryTime, r.halfQueryTime, (double)r.pairs / n,
+				r.mismatches > 0 ? "  MISMATCH" : "");
+		}
+	}
+}
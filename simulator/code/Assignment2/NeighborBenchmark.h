@@ -0,0 +1,40 @@
+#pragma once
+
+#include "ParticleStore.h"
+#include <vector>
+#include <string>
+
+// Generated particle positions to search, with their bounding box.
+struct BenchmarkCloud {
+	std::string name;
+	PositionArray positions;
+	P3D minCorner, maxCorner;
+};
+
+// Timings (in milliseconds) and verification results of one neighbor backend on one cloud.
+struct NeighborBenchmarkResult {
+	std::string backend;
+	double buildTime;
+	double queryTime;
+	double halfQueryTime;
+	long long pairs;
+	long long halfPairs;
+	// Particles whose neighbors were compared against brute force, and how many of those differed
+	int checkedParticles;
+	int mismatches;
+};
+
+// n particles spread uniformly over a box sized for about 30 neighbors per particle.
+BenchmarkCloud makeUniformCloud(int n);
+// n particles in Gaussian clusters scattered over the same box, so cell occupancy is very uneven.
+BenchmarkCloud makeClusteredCloud(int n);
+// The vertices of an OBJ mesh, tiled side by side until there are n particles (n <= 0 keeps one copy).
+BenchmarkCloud makeMeshCloud(const std::string &path, int n);
+
+// Builds and queries every neighbor backend on the cloud with radius kernelH, keeping the best
+// of the given number of repeats. The full lists of verifyCount evenly spaced particles are
+// compared against brute force, and their half lists are checked to be duplicate-free subsets.
+std::vector<NeighborBenchmarkResult> benchmarkNeighborBackends(const BenchmarkCloud &cloud, int verifyCount, int repeats = 1);
+
+// Runs the benchmark on uniform clouds of the given sizes and prints the results to the console.
+void runNeighborBenchmark(const std::vector<int> &sizes);
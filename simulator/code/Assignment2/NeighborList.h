@@ -0,0 +1,121 @@
+#pragma once
+
+#include "Utils/ThreadPool.h"
+#include <vector>
+#include <algorithm>
+
+/**
+ * Neighbor lists of all particles in compressed sparse row form: the neighbors of particle i
+ * are indices[offsets[i]] ... indices[offsets[i + 1] - 1]. Both arrays keep their capacity
+ * between builds, so rebuilding does not allocate once the neighbor count has settled.
+ */
+class NeighborList {
+public:
+	std::vector<int> offsets;
+	std::vector<int> indices;
+
+	int particleCount() const { return (int)offsets.size() - 1; }
+	int pairCount() const { return (int)indices.size(); }
+	const int* begin(int i) const { return indices.data() + offsets[i]; }
+	const int* end(int i) const { return indices.data() + offsets[i + 1]; }
+
+	void clear() {
+		offsets.assign(1, 0);
+		indices.clear();
+	}
+
+	/**
+	 * Rebuilds the lists of particles 0 ... n - 1. search(i, out) must append the neighbors of
+	 * particle i to out. The particles are split into numChunks contiguous ranges that are
+	 * searched independently into their own scratch buffer, which makes the ranges safe to
+	 * fill concurrently; the buffers are then concatenated into indices.
+	 */
+	template<typename F>
+	void build(int n, F search, int numChunks = 1) {
+		offsets.resize(n + 1);
+		offsets[0] = 0;
+		if (numChunks <= 1) {
+			indices.clear();
+			for (int i = 0; i < n; i++) {
+				search(i, indices);
+				offsets[i + 1] = (int)indices.size();
+			}
+			return;
+		}
+
+		chunkScratch.resize(numChunks);
+		for (int c = 0; c < numChunks; c++) {
+			fillChunk(c, n, numChunks, search);
+		}
+		concatenateChunks(n, numChunks);
+	}
+
+	// Same as build, with one chunk per thread of the pool, searched and copied concurrently.
+	template<typename F>
+	void build(int n, F search, ThreadPool &pool) {
+		int numChunks = pool.threadCount();
+		if (numChunks <= 1) {
+			build(n, search);
+			return;
+		}
+
+		offsets.resize(n + 1);
+		offsets[0] = 0;
+		chunkScratch.resize(numChunks);
+		chunkBase.resize(numChunks + 1);
+		pool.run([&](int c) {
+			fillChunk(c, n, numChunks, search);
+		});
+
+		chunkBase[0] = 0;
+		for (int c = 0; c < numChunks; c++) {
+			chunkBase[c + 1] = chunkBase[c] + (int)chunkScratch[c].size();
+		}
+		indices.resize(chunkBase[numChunks]);
+		pool.run([&](int c) {
+			int base = chunkBase[c];
+			for (int i = chunkBegin(c, n, numChunks); i < chunkBegin(c + 1, n, numChunks); i++) {
+				offsets[i + 1] += base;
+			}
+			std::copy(chunkScratch[c].begin(), chunkScratch[c].end(), indices.begin() + base);
+		});
+	}
+
+	// Searches the particles of chunk c into its scratch buffer, recording per-particle counts.
+	template<typename F>
+	void fillChunk(int c, int n, int numChunks, F search) {
+		std::vector<int> &scratch = chunkScratch[c];
+		scratch.clear();
+		for (int i = chunkBegin(c, n, numChunks); i < chunkBegin(c + 1, n, numChunks); i++) {
+			search(i, scratch);
+			offsets[i + 1] = (int)scratch.size();
+		}
+	}
+
+	// Turns the per-chunk counts into global offsets and copies the chunks into indices.
+	void concatenateChunks(int n, int numChunks) {
+		int total = 0;
+		for (int c = 0; c < numChunks; c++) {
+			total += (int)chunkScratch[c].size();
+		}
+		indices.resize(total);
+
+		int base = 0;
+		for (int c = 0; c < numChunks; c++) {
+			std::vector<int> &scratch = chunkScratch[c];
+			for (int i = chunkBegin(c, n, numChunks); i < chunkBegin(c + 1, n, numChunks); i++) {
+				offsets[i + 1] += base;
+			}
+			std::copy(scratch.begin(), scratch.end(), indices.begin() + base);
+			base += (int)scratch.size();
+		}
+	}
+
+	static int chunkBegin(int c, int n, int numChunks) {
+		return (int)((long long)n * c / numChunks);
+	}
+
+private:
+	std::vector<std::vector<int>> chunkScratch;
+	std::vector<int> chunkBase;
+};
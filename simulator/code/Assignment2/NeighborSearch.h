@@ -0,0 +1,87 @@
+#pragma once
+
+#include "ParticleStore.h"
+#include "Utils/ThreadPool.h"
+#include <vector>
+#include <algorithm>
+
+// The neighbor search structures the particle system can use.
+enum NeighborBackend {
+	SPATIAL_MAP_BACKEND,
+	UNIFORM_GRID_BACKEND,
+	SPATIAL_HASH_BACKEND,
+	NEIGHBOR_BACKEND_COUNT
+};
+
+/**
+ * Common interface of the acceleration structures used to find particle neighbors.
+ * Each rebuild the structure is cleared, every particle is added, build() is called once,
+ * and then findNeighbors() can be queried for any particle. Neighbors are the particles
+ * whose predicted positions are closer than the search radius.
+ */
+class NeighborSearch {
+public:
+	NeighborSearch() : pool(NULL) {}
+	virtual ~NeighborSearch() {}
+
+	// Threads that structures able to build in parallel may use (NULL builds serially).
+	void setThreadPool(ThreadPool *pool) { this->pool = pool; }
+
+	// Sets the search radius, which is also the cell size of the structure.
+	virtual void setRadius(double r) = 0;
+	virtual void clear() = 0;
+	virtual void add(int i, const P3D &x) = 0;
+	// Called once after all particles have been added, before any query.
+	virtual void build() {}
+
+	// Brings the structure up to date with the current predicted positions. Returns the number
+	// of particles that changed cells, and sets rebuilt if the whole structure was rebuilt.
+	// Only SpatialMap patches its buckets in place, falling back to a full rebuild when more
+	// than maxChurn of the particles changed cells; UniformGrid and SpatialHash ignore maxChurn,
+	// keeping their sorted cells when no particle changed cells and re-sorting them otherwise.
+	// All of them rebuild when the particle count changed or after clear(). By default this
+	// always rebuilds.
+	virtual int update(const PositionArray &x_star, double /*maxChurn*/, bool &rebuilt) {
+		rebuildAll(x_star);
+		rebuilt = true;
+		return x_star.size();
+	}
+
+	void rebuildAll(const PositionArray &x_star) {
+		clear();
+		for (int i = 0; i < (int)x_star.size(); i++) {
+			add(i, x_star[i]);
+		}
+		build();
+	}
+
+	// Appends the neighbors of particle i to out. Queries do not modify the structure,
+	// so they can run concurrently.
+	virtual void findNeighbors(int i, const PositionArray &x_star, std::vector<int> &out) const = 0;
+
+	// Appends the neighbors of particle i such that, over all particles, every unordered pair
+	// of neighbors is reported exactly once and no particle is reported as its own neighbor.
+	// By default this keeps the neighbors with a larger index; grids can do better by only
+	// visiting half of the surrounding cells.
+	virtual void findHalfNeighbors(int i, const PositionArray &x_star, std::vector<int> &out) const {
+		size_t start = out.size();
+		findNeighbors(i, x_star, out);
+		out.erase(std::remove_if(out.begin() + start, out.end(), [i](int j) { return j <= i; }), out.end());
+	}
+
+protected:
+	ThreadPool *pool;
+
+	int threadCount() const { return pool ? pool->threadCount() : 1; }
+
+	// Calls f(begin, end, t) for the ranges of [0, n) given to each thread of the pool, or
+	// f(0, n, 0) without one.
+	template<typename F>
+	void forEachRange(int n, F f) const {
+		if (pool) {
+			pool->forEachRange(n, f);
+		} else {
+			f(0, n, 0);
+		}
+	}
+};
@@ -1,6 +1,22 @@
 #include <GUILib/GLUtils.h>
 #include "PBFApp.h"
 #include "Constants.h"
+#include "NeighborBenchmark.h"
+#include "KernelBenchmark.h"
+#include "ScalingBenchmark.h"
+#include "SolverBenchmark.h"
+#include <sys/stat.h>
+
+// When the file at path was last modified, or 0 if it does not exist.
+static time_t modificationTime(const std::string &path) {
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0) return 0;
+	return info.st_mtime;
+}
+
+static void TW_CALL reloadParamsButtonEvent(void* app) {
+	((PBFApp*)app)->reloadParams();
+}
 
 PBFApp::PBFApp() {
 	setWindowTitle("Position-Based Fluid Simulator");
@@ -8,14 +24,78 @@ PBFApp::PBFApp() {
 
 	TwAddVarRW(mainMenuBar, "Draw Particles", TW_TYPE_BOOLCPP, &ParticleSystem::drawParticles, "");
 	TwAddVarRW(mainMenuBar, "Enable Gravity", TW_TYPE_BOOLCPP, &ParticleSystem::enableGravity, "");
+	TwAddVarRW(mainMenuBar, "Adaptive Time Step", TW_TYPE_BOOLCPP, &adaptiveTimeStep, "");
+	TwAddVarRW(mainMenuBar, "CFL Number", TW_TYPE_DOUBLE, &cflNumber, " min=0.05 max=2 step=0.05 ");
+	TwAddVarRW(mainMenuBar, "Time Step", TW_TYPE_DOUBLE, &ParticleSystem::params.deltaT, " min=0.0005 step=0.0005 ");
+	TwAddVarRW(mainMenuBar, "Kernel Radius", TW_TYPE_DOUBLE, &ParticleSystem::params.kernelH, " min=0.05 step=0.01 ");
+	TwAddVarRW(mainMenuBar, "Rest Density", TW_TYPE_DOUBLE, &ParticleSystem::params.restDensity, " min=1 step=100000 ");
+	TwAddVarRW(mainMenuBar, "CFM Epsilon", TW_TYPE_DOUBLE, &ParticleSystem::params.cfmEpsilon, " min=0 step=0.01 ");
+	TwAddVarRW(mainMenuBar, "Tensile Delta Q", TW_TYPE_DOUBLE, &ParticleSystem::params.tensileDeltaQ, " min=0.01 max=0.95 step=0.05 ");
+	TwAddVarRW(mainMenuBar, "Tensile K", TW_TYPE_DOUBLE, &ParticleSystem::params.tensileK, " min=0 step=0.01 ");
+	TwAddVarRW(mainMenuBar, "Tensile N", TW_TYPE_INT32, &ParticleSystem::params.tensileN, " min=0 max=8 ");
+	TwAddVarRW(mainMenuBar, "Viscosity", TW_TYPE_DOUBLE, &ParticleSystem::params.viscosityC, " min=0 step=0.001 ");
+	TwAddVarRW(mainMenuBar, "Vorticity Epsilon", TW_TYPE_DOUBLE, &ParticleSystem::params.vorticityEpsilon, " min=0 step=0.0001 ");
+	TwAddButton(mainMenuBar, "Reload Parameters", reloadParamsButtonEvent, this, "");
+	TwAddVarRW(mainMenuBar, "Brute-Force Neighbors", TW_TYPE_BOOLCPP, &ParticleSystem::bruteForceNeighbors, "");
+
+	TwEnumVal neighborBackends[] = {
+		{ SPATIAL_MAP_BACKEND, "Spatial Map" },
+		{ UNIFORM_GRID_BACKEND, "Uniform Grid" },
+		{ SPATIAL_HASH_BACKEND, "Spatial Hash" },
+	};
+	TwType neighborBackendType = TwDefineEnum("NeighborBackend", neighborBackends, NEIGHBOR_BACKEND_COUNT);
+	TwAddVarRW(mainMenuBar, "Neighbor Backend", neighborBackendType, &ParticleSystem::neighborBackend, "");
+	TwAddVarRW(mainMenuBar, "Reorder Interval", TW_TYPE_INT32, &ParticleSystem::reorderInterval, " min=0 ");
+	TwAddVarRW(mainMenuBar, "Neighbor Skin", TW_TYPE_DOUBLE, &ParticleSystem::neighborSkin, " min=0 step=0.005 ");
+	TwAddVarRW(mainMenuBar, "Symmetric Pairs", TW_TYPE_BOOLCPP, &ParticleSystem::symmetricPairs, "");
+	TwAddVarRW(mainMenuBar, "Max Cell Churn", TW_TYPE_DOUBLE, &ParticleSystem::maxCellChurn, " min=0 max=1 step=0.05 ");
+
+	TwEnumVal simdLevels[] = {
+		{ SIMD_SCALAR, "Scalar" },
+		{ SIMD_SSE4, "SSE4" },
+		{ SIMD_AVX2, "AVX2" },
+		{ SIMD_AVX512, "AVX-512" },
+	};
+	TwType simdLevelType = TwDefineEnum("SimdLevel", simdLevels, SIMD_LEVEL_COUNT);
+	TwAddVarRW(mainMenuBar, "Kernel SIMD", simdLevelType, &ParticleSystem::kernelSimd, "");
+	TwAddVarRW(mainMenuBar, "Cache Pair Kernels", TW_TYPE_BOOLCPP, &ParticleSystem::cachePairs, "");
+	TwAddVarRW(mainMenuBar, "Threads", TW_TYPE_INT32, &ParticleSystem::threadCount, " min=1 ");
+	TwAddVarRW(mainMenuBar, "Solver Tolerance", TW_TYPE_DOUBLE, &ParticleSystem::params.solverTolerance, " min=0 step=0.001 ");
+	TwAddVarRW(mainMenuBar, "Min Solver Iterations", TW_TYPE_INT32, &ParticleSystem::params.minSolverIterations, " min=0 ");
+	TwAddVarRW(mainMenuBar, "Max Solver Iterations", TW_TYPE_INT32, &ParticleSystem::params.maxSolverIterations, " min=1 ");
+	TwAddVarRW(mainMenuBar, "Log Iterations", TW_TYPE_BOOLCPP, &ParticleSystem::logIterations, "");
+
+	TwEnumVal solverAccelerations[] = {
+		{ JACOBI_SOLVER, "Jacobi" },
+		{ SOR_SOLVER, "SOR" },
+		{ CHEBYSHEV_SOLVER, "Chebyshev" },
+		{ GAUSS_SEIDEL_SOLVER, "Gauss-Seidel" },
+	};
+	TwType solverAccelerationType = TwDefineEnum("SolverAcceleration", solverAccelerations, SOLVER_ACCELERATION_COUNT);
+	TwAddVarRW(mainMenuBar, "Solver Acceleration", solverAccelerationType, &ParticleSystem::solverAcceleration, "");
+	TwAddVarRW(mainMenuBar, "SOR Factor", TW_TYPE_DOUBLE, &ParticleSystem::sorFactor, " min=0.1 max=1.99 step=0.05 ");
+	TwAddVarRW(mainMenuBar, "XPBD Constraint", TW_TYPE_BOOLCPP, &ParticleSystem::xpbdConstraint, "");
+	TwAddVarRW(mainMenuBar, "Compliance", TW_TYPE_DOUBLE, &ParticleSystem::params.compliance, " min=0 step=0.000001 ");
+	TwAddVarRW(mainMenuBar, "Warm Start", TW_TYPE_BOOLCPP, &ParticleSystem::warmStart, "");
+	TwAddVarRW(mainMenuBar, "Warm Start Damping", TW_TYPE_DOUBLE, &ParticleSystem::params.warmStartDamping, " min=0 max=1 step=0.05 ");
 
 	showGroundPlane = false;
 	showDesignEnvironmentBox = true;
 	showReflections = false;
 
+	// Watched even if it cannot be loaded yet
+	paramsFile = SIMULATION_PARAMS_FILE;
+	paramsModified = 0;
+	loadParams(paramsFile);
 	particleSystem = ParticleSystemLoader::loadFromOBJ("../meshes/bunny300.obj");
 
 	pickedParticle = -1;
+	adaptiveTimeStep = false;
+	cflNumber = CFL_NUMBER;
+	timeStep = ParticleSystem::params.deltaT;
+	frameSteps = 0;
+	frameMinStep = frameMaxStep = ParticleSystem::params.deltaT;
+	frameTime = 0;
 }
 
 PBFApp::~PBFApp(void){
@@ -145,6 +225,24 @@ void PBFApp::loadFile(const char* fName) {
 	fileName.assign(fName);
 
 	std::string fNameExt = fileName.substr(fileName.find_last_of('.') + 1);
+	if (fNameExt == "params") {
+		loadParams(fileName);
+	}
+}
+
+bool PBFApp::loadParams(const std::string &path) {
+	time_t modified = modificationTime(path);
+	if (!ParticleSystem::params.load(path)) {
+		// Keep watching the current file, without trying it again until it changes once more
+		if (path == paramsFile) {
+			paramsModified = modified;
+		}
+		return false;
+	}
+	paramsFile = path;
+	paramsModified = modified;
+	Logger::consolePrint("Loaded simulation parameters from %s\n", path.c_str());
+	return true;
 }
 
 void PBFApp::saveFile(const char* fName) {
@@ -154,15 +252,67 @@ void PBFApp::saveFile(const char* fName) {
 
 // Run the App tasks
 void PBFApp::process() {
-	// Take enough steps so that we are always running in (close to) real time
-	int numSteps = (int)((1. / 30.) / DELTA_T);
-	if (numSteps < 1) numSteps = 1;
-	for (int i = 0; i < numSteps; i++) {
-		particleSystem->integrate_PBF(DELTA_T);
-		if (pickedParticle > -1) {
-			particleSystem->setPosition(pickedParticle, pickedPosition);
+	// Edits to the parameter file take effect from this frame on
+	if (!paramsFile.empty() && modificationTime(paramsFile) != paramsModified) {
+		loadParams(paramsFile);
+	}
+
+	frameSteps = 0;
+	frameMinStep = MAX_DELTA_T;
+	frameMaxStep = 0;
+	frameTime = 0;
+
+	if (!adaptiveTimeStep) {
+		// Take enough steps so that we are always running in (close to) real time
+		double deltaT = ParticleSystem::params.deltaT;
+		int numSteps = (int)(FRAME_TIME / deltaT);
+		if (numSteps < 1) numSteps = 1;
+		for (int i = 0; i < numSteps; i++) {
+			step(deltaT);
 		}
+		return;
+	}
+
+	// Steps of the length the particles allow, stretched or shrunk so that the last one ends
+	// exactly on the frame
+	double remaining = FRAME_TIME;
+	while (remaining > 0) {
+		double delta = nextTimeStep(remaining);
+		step(delta);
+		remaining = delta < remaining ? remaining - delta : 0;
 	}
+	Logger::logPrint("frame: %d steps, dt %.5f - %.5f s, max speed %.3f\n",
+		frameSteps, frameMinStep, frameMaxStep, particleSystem->getStats().maxSpeed);
+}
+
+// Length of the next step when remaining is left of the frame. timeStep follows the CFL condition
+// on the speed the fastest particle had after the last step, within the bounds and growing by at
+// most DELTA_T_MAX_GROWTH at a time; the step is that evened out over the steps still needed.
+double PBFApp::nextTimeStep(double remaining) {
+	double delta = MAX_DELTA_T;
+	double speed = particleSystem->getStats().maxSpeed;
+	if (speed > 0) {
+		delta = min(delta, cflNumber * ParticleSystem::params.kernelH / speed);
+	}
+	timeStep = max(min(delta, timeStep * DELTA_T_MAX_GROWTH), MIN_DELTA_T);
+
+	int steps = (int)ceil(remaining / timeStep - 1e-9);
+	return steps > 1 ? remaining / steps : remaining;
+}
+
+void PBFApp::step(double delta) {
+	particleSystem->integrate_PBF(delta);
+	if (pickedParticle > -1 && particleSystem->wasReordered()) {
+		pickedParticle = particleSystem->getNewIndex(pickedParticle);
+	}
+	if (pickedParticle > -1) {
+		particleSystem->setPosition(pickedParticle, pickedPosition);
+	}
+
+	frameSteps++;
+	frameMinStep = min(frameMinStep, delta);
+	frameMaxStep = max(frameMaxStep, delta);
+	frameTime += particleSystem->getStats().stepTime;
 }
 
 // Draw the App scene - camera transformations, lighting, shadows, reflections, etc apply to everything drawn by this method
@@ -172,14 +322,51 @@ void PBFApp::drawScene() {
 
 // This is the wild west of drawing - things that want to ignore depth buffer, camera transformations, etc. Not pretty, quite hacky, but flexible. Individual apps should be careful with implementing this method. It always gets called right at the end of the draw function
 void PBFApp::drawAuxiliarySceneInfo() {
+	const SimulationStats &stats = particleSystem->getStats();
+
+	glPushMatrix();
+	glLoadIdentity();
+	glTranslatef(0.0f, 0.0f, -1.0f);
+
+	glColor3d(1.0, 1.0, 1.0);
+	glprint(viewportWidth - 400, viewportHeight - 35, "Step: %6.2lf ms on %d threads, %d substeps (%d rebuilds) (neighbors %6.2lf, solver %6.2lf, velocity %6.2lf)",
+		stats.stepTime, stats.threads, stats.substeps, stats.substepRebuilds, stats.neighborSearchTime, stats.solverTime, stats.velocityUpdateTime);
+	glprint(viewportWidth - 400, viewportHeight - 55, "Mean neighbor span: %8.1lf (last reorder: %.1lf -> %.1lf)",
+		stats.meanNeighborSpan, stats.spanBeforeReorder, stats.spanAfterReorder);
+	glprint(viewportWidth - 400, viewportHeight - 75, "Neighbor rebuilds: %d / %d steps (%.1lf%%), last %d steps ago",
+		stats.neighborRebuilds, stats.steps, 100.0 * stats.neighborRebuilds / max(stats.steps, 1), stats.stepsSinceRebuild);
+	glprint(viewportWidth - 400, viewportHeight - 95, "Cell churn: %d particles (%.1lf%%), %d updates / %d rebuilds",
+		stats.cellChanges, 100.0 * stats.cellChurn, stats.searchUpdates, stats.searchRebuilds);
+	glprint(viewportWidth - 400, viewportHeight - 115, "Kernels: %s, %s, %d lanes (host supports %s), %lld evaluations",
+		kernelFamilyName(stats.kernelFamily), simdLevelName(stats.kernelSimd), stats.kernelLanes, simdLevelName(hostSimdLevel()), stats.kernelEvaluations);
+	double busy = 0;
+	for (double threadBusy : stats.threadBusyTimes) busy += threadBusy;
+	glprint(viewportWidth - 400, viewportHeight - 135, "Task graph: %6.2lf ms, %d tasks, threads busy %.1lf%% of the time ('tasks' for details)",
+		stats.graphTime, (int)stats.tasks.size(), stats.graphTime > 0 ? 100.0 * busy / (stats.graphTime * stats.threads) : 0.0);
+	if (!stats.densityErrors.empty()) {
+		glprint(viewportWidth - 400, viewportHeight - 155, "Solver: %s%s%s, %d iterations, density error %.6lf -> %.6lf (details in log.txt)",
+			solverAccelerationName(ParticleSystem::solverAcceleration), ParticleSystem::xpbdConstraint ? " XPBD" : "",
+			ParticleSystem::warmStart ? " warm-started" : "",
+			stats.solverIterations, stats.densityErrors.front(), stats.densityErrors.back());
+	}
+	if (!stats.correctionSizes.empty()) {
+		glprint(viewportWidth - 400, viewportHeight - 175, "Corrections: %.3e -> %.3e, relaxation %.3lf (spectral radius %.3lf)",
+			stats.correctionSizes.front(), stats.correctionSizes.back(), stats.relaxation, stats.spectralRadius);
+	}
+	glprint(viewportWidth - 400, viewportHeight - 195, "Frame: %d %s steps of %.4lf - %.4lf s, %6.2lf ms, max speed %.3lf",
+		frameSteps, adaptiveTimeStep ? "adaptive" : "fixed", frameMinStep, frameMaxStep, frameTime, stats.maxSpeed);
 
+	glPopMatrix();
 }
 
 // Restart the application.
 void PBFApp::restart() {
+	// The system owns its worker threads
+	delete particleSystem;
 	particleSystem = ParticleSystemLoader::loadFromOBJ("../meshes/bunny300.obj");
 
 	pickedParticle = -1;
+	timeStep = ParticleSystem::params.deltaT;
 }
 
 bool PBFApp::processCommandLine(const std::string& cmdLine) {
@@ -188,6 +375,81 @@ bool PBFApp::processCommandLine(const std::string& cmdLine) {
 
 	string command, argument;
 
+	if (cmdLine == "tasks") {
+		// When each task of the last step ran, and how long each thread sat idle
+		const SimulationStats &stats = particleSystem->getStats();
+		Logger::consolePrint("Task graphs of the last step: %.2f ms on %d threads\n", stats.graphTime, stats.threads);
+		for (const TaskTiming &task : stats.tasks) {
+			Logger::consolePrint("  %-26s %7.3f - %7.3f ms  busy %7.3f ms  %4d ranges, %3d stolen\n",
+				task.name.c_str(), task.start, task.end, task.busy, task.ranges, task.steals);
+		}
+		for (int t = 0; t < (int)stats.threadBusyTimes.size(); t++) {
+			Logger::consolePrint("  thread %2d: busy %7.3f ms, idle %7.3f ms\n", t, stats.threadBusyTimes[t], stats.graphTime - stats.threadBusyTimes[t]);
+		}
+		return true;
+	}
+
+	if (cmdLine.compare(0, 6, "params") == 0 && (cmdLine.size() == 6 || cmdLine[6] == ' ')) {
+		// params [file], without a file the current one is loaded again
+		istringstream args(cmdLine.substr(6));
+		string path = paramsFile;
+		args >> path;
+		loadParams(path);
+		return true;
+	}
+
+	if (cmdLine.compare(0, 17, "benchmark threads") == 0) {
+		// benchmark threads [mesh] [steps]
+		istringstream args(cmdLine.substr(17));
+		string mesh = "../meshes/bunny2500.obj";
+		int steps = 100;
+		args >> mesh >> steps;
+		runThreadScalingBenchmark(mesh, steps);
+		return true;
+	}
+
+	if (cmdLine.compare(0, 16, "benchmark solver") == 0) {
+		// benchmark solver [steps] [spacing]
+		istringstream args(cmdLine.substr(16));
+		int steps = 60;
+		double spacing = 0.06;
+		args >> steps >> spacing;
+		runSolverBenchmark(spacing, steps);
+		return true;
+	}
+
+	if (cmdLine.compare(0, 18, "benchmark substeps") == 0) {
+		// benchmark substeps [steps] [spacing]
+		istringstream args(cmdLine.substr(18));
+		int steps = 60;
+		double spacing = 0.06;
+		args >> steps >> spacing;
+		runSubstepBenchmark(spacing, steps);
+		return true;
+	}
+
+	if (cmdLine.compare(0, 17, "benchmark kernels") == 0) {
+		// benchmark kernels [support radii in particle spacings...]
+		istringstream args(cmdLine.substr(17));
+		vector<double> ratios;
+		double ratio;
+		while (args >> ratio) ratios.push_back(ratio);
+		if (ratios.empty()) ratios = { 1.5, 2.0, 2.5, 3.0 };
+		runKernelBenchmark(ratios);
+		return true;
+	}
+
+	if (cmdLine.compare(0, 9, "benchmark") == 0) {
+		// benchmark [particle counts...]
+		istringstream args(cmdLine.substr(9));
+		vector<int> sizes;
+		int n;
+		while (args >> n) sizes.push_back(n);
+		if (sizes.empty()) sizes = { 10000, 100000, 1000000 };
+		runNeighborBenchmark(sizes);
+		return true;
+	}
+
 	if ((iss >> command >> argument)) {
 		if (command == "load") {
 			if (argument.length() < 5) {
@@ -3,6 +3,7 @@
 #include <GUILib/GLApplication.h>
 #include <string>
 #include <map>
+#include <ctime>
 #include "ParticleSystemLoader.h"
 
 /**
@@ -14,6 +15,27 @@ private:
 	int pickedParticle;
 	P3D pickedPosition;
 
+	// Time steps: fixed steps of params.deltaT, or adaptive ones that keep the CFL number of the
+	// fastest particle at cflNumber. timeStep is the step the controller last asked for, before
+	// it was fitted to the frame.
+	bool adaptiveTimeStep;
+	double cflNumber;
+	double timeStep;
+	// Steps the last frame took, their shortest and longest length, and the time spent in them
+	// (in milliseconds)
+	int frameSteps;
+	double frameMinStep;
+	double frameMaxStep;
+	double frameTime;
+
+	double nextTimeStep(double remaining);
+	void step(double delta);
+
+	// File the simulation parameters were last loaded from (SIMULATION_PARAMS_FILE until one has
+	// been), and when it had been modified then. process() loads it again whenever it changes.
+	std::string paramsFile;
+	time_t paramsModified;
+
 public:
 	static double k;
 	// constructor
@@ -52,6 +74,12 @@ public:
 	// Interactivity functions
 	bool pickParticle(double screenX, double screenY);
 
+	// Loads ParticleSystem::params from a file, and watches it for changes from then on. If the
+	// file cannot be loaded, the parameters and the watched file stay as they were.
+	// reloadParams() loads the watched file again, undoing the edits made in the menu since.
+	bool loadParams(const std::string &path);
+	bool reloadParams() { return loadParams(paramsFile); }
+
 };
 
 
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "MathLib/V3D.h"
+#include "MathLib/P3D.h"
+#include <vector>
+#include <cstdlib>
+#include <new>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// Alignment of every particle attribute array, one cache line, which is also enough for
+// the widest vector loads.
+#define PARTICLE_ARRAY_ALIGNMENT 64
+
+// Allocator that places the elements of a std::vector on PARTICLE_ARRAY_ALIGNMENT boundaries.
+template<typename T>
+struct AlignedAllocator {
+	typedef T value_type;
+
+	AlignedAllocator() {}
+	template<typename U>
+	AlignedAllocator(const AlignedAllocator<U> &) {}
+
+	T* allocate(std::size_t n) {
+		void *p;
+#ifdef _WIN32
+		p = _aligned_malloc(n * sizeof(T), PARTICLE_ARRAY_ALIGNMENT);
+		if (!p) throw std::bad_alloc();
+#else
+		if (posix_memalign(&p, PARTICLE_ARRAY_ALIGNMENT, n * sizeof(T)) != 0) throw std::bad_alloc();
+#endif
+		return (T*)p;
+	}
+
+	void deallocate(T *p, std::size_t) {
+#ifdef _WIN32
+		_aligned_free(p);
+#else
+		free(p);
+#endif
+	}
+
+	template<typename U>
+	struct rebind { typedef AlignedAllocator<U> other; };
+
+	bool operator==(const AlignedAllocator &) const { return true; }
+	bool operator!=(const AlignedAllocator &) const { return false; }
+};
+
+template<typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+/**
+ * Particle state stored as one contiguous array per attribute: the attributes of particle i
+ * are x_i[i], v_i[i], x_star[i] and so on. A pass only pulls the arrays it reads into the
+ * cache, instead of whole particles, and each array can be streamed through by vector loops.
+ * Scalar is the precision of the simulation. Densities are sums over all neighbors whose
+ * relative deviation from the rest density drives the solver, so they are always kept in double.
+ */
+template<typename Scalar>
+class ParticleStore {
+public:
+	typedef Eigen::Matrix<Scalar, 3, 1> Vector3;
+
+	AlignedVector<Vector3> x_i;
+	AlignedVector<Vector3> v_i;
+	AlignedVector<Vector3> x_star;
+	AlignedVector<Scalar> lambda_i;
+	// Sum of the lambdas of the iterations of the last substep, for XPBD
+	AlignedVector<double> lambda_sum;
+	AlignedVector<Vector3> delta_p;
+	AlignedVector<double> density;
+	AlignedVector<Vector3> vorticity_W;
+	AlignedVector<Vector3> vorticity_N;
+
+	int size() const { return (int)x_i.size(); }
+	bool empty() const { return x_i.empty(); }
+
+	void add(const Vector3 &x, const Vector3 &v) {
+		x_i.push_back(x);
+		v_i.push_back(v);
+		x_star.push_back(x);
+		lambda_i.push_back(0);
+		lambda_sum.push_back(0);
+		delta_p.push_back(Vector3::Zero());
+		density.push_back(0);
+		vorticity_W.push_back(Vector3::Zero());
+		vorticity_N.push_back(Vector3::Zero());
+	}
+
+	// Reorders the particles so that particle k is the one that was at index order[k].
+	void permute(const std::vector<int> &order) {
+		permuteArray(x_i, order);
+		permuteArray(v_i, order);
+		permuteArray(x_star, order);
+		permuteArray(lambda_i, order);
+		permuteArray(lambda_sum, order);
+		permuteArray(delta_p, order);
+		permuteArray(density, order);
+		permuteArray(vorticity_W, order);
+		permuteArray(vorticity_N, order);
+	}
+
+private:
+	template<typename T>
+	static void permuteArray(AlignedVector<T> &a, const std::vector<int> &order) {
+		AlignedVector<T> permuted(a.size());
+		for (int k = 0; k < (int)order.size(); k++) {
+			permuted[k] = a[order[k]];
+		}
+		a.swap(permuted);
+	}
+};
+
+// Predicted positions in double, as handed to the neighbor search structures
+typedef AlignedVector<P3D> PositionArray;
@@ -10,35 +10,51 @@
 #include "ParticleSystem.h"
 #include "GUILib/OBJReader.h"
 #include "Utils/Logger.h"
+#include "Utils/Timer.h"
 #include "Constants.h"
 #include <math.h>
+#include <algorithm>
+#include <stdint.h>
+#include <string>
 
 #include<iostream>
 using namespace std;
 
 GLuint makeBoxDisplayList();
 
-// UPDATING REST_DENSITY IN CONSTANTS.H WAS NOT OVERRIDING THEIR CACHED VALUES. SMH!
-volatile double rd = 30000000;
-
-ParticleSystem::ParticleSystem(vector<ParticleInit>& initialParticles)
-        : particleMap(KERNEL_H)
+template<typename Scalar, typename Kernels>
+ParticleSystemT<Scalar, Kernels>::ParticleSystemT(vector<ParticleInit>& initialParticles)
+        : pool(threadCount),
+          particleMap(params.kernelH),
+          particleGrid(params.kernelH, P3D(-1, 0, -1), P3D(1, 2, 1)),
+          particleHash(params.kernelH),
+          densityKernel(params.kernelH),
+          gradientKernel(params.kernelH)
 {
     int numParticles = initialParticles.size();
     Logger::consolePrint("Created particle system with %d particles", numParticles);
     drawParticles = true;
     count = 0;
+    stepCount = 0;
+    relaxation = 1;
+    complianceScale = 0;
+    lambdaConstraint = -1;
+    warmStarting = false;
+    searchSkin = neighborSkin;
+    reorderedLastStep = false;
+    neighborBuildRadius = 0;
+    neighborBuildMode = -1;
+    neighborBuildSymmetric = false;
+    symmetricStep = false;
+    colorsBuilt = false;
+    pairKernelsCached = false;
+    drawBufferFilled = false;
+    particleGrid.setThreadPool(&pool);
+    applyParams();
 
     // Create all particles from initial data
     for (auto ip : initialParticles) {
-        Particle p;
-        p.x_i = ip.position;
-        p.v_i = ip.velocity;
-        p.x_star = p.x_i;
-        p.neighbors.clear();
-        p.vorticity_W = V3D();
-        p.vorticity_N = V3D();
-        particles.push_back(p);
+        particles.add(ip.position.cast<Scalar>(), ip.velocity.cast<Scalar>());
     }
 
     // Create floor and walls
@@ -67,31 +83,67 @@ ParticleSystem::ParticleSystem(vector<ParticleInit>& initialParticles)
     boxList = makeBoxDisplayList();
 }
 
-ParticleSystem::~ParticleSystem() {
+template<typename Scalar, typename Kernels>
+ParticleSystemT<Scalar, Kernels>::~ParticleSystemT() {
     if (boxList >= 0) {
         glDeleteLists(boxList, 1);
     }
 }
 
-bool ParticleSystem::drawParticles = true;
-bool ParticleSystem::enableGravity = true;
+SimulationParams ParticleSystemSettings::params;
+bool ParticleSystemSettings::drawParticles = true;
+bool ParticleSystemSettings::enableGravity = true;
+bool ParticleSystemSettings::bruteForceNeighbors = false;
+NeighborBackend ParticleSystemSettings::neighborBackend = UNIFORM_GRID_BACKEND;
+int ParticleSystemSettings::reorderInterval = REORDER_INTERVAL;
+double ParticleSystemSettings::neighborSkin = NEIGHBOR_SKIN;
+bool ParticleSystemSettings::symmetricPairs = true;
+double ParticleSystemSettings::maxCellChurn = MAX_CELL_CHURN;
+SimdLevel ParticleSystemSettings::kernelSimd = hostSimdLevel();
+bool ParticleSystemSettings::cachePairs = true;
+int ParticleSystemSettings::threadCount = ThreadPool::hardwareThreads();
+bool ParticleSystemSettings::logIterations = false;
+SolverAcceleration ParticleSystemSettings::solverAcceleration = JACOBI_SOLVER;
+bool ParticleSystemSettings::xpbdConstraint = false;
+double ParticleSystemSettings::sorFactor = SOR_FACTOR;
+double ParticleSystemSettings::substepMargin = SUBSTEP_MARGIN;
+bool ParticleSystemSettings::warmStart = false;
+
+const char* solverAccelerationName(SolverAcceleration acceleration) {
+    switch (acceleration) {
+    case SOR_SOLVER:
+        return "SOR";
+    case CHEBYSHEV_SOLVER:
+        return "Chebyshev";
+    case GAUSS_SEIDEL_SOLVER:
+        return "Gauss-Seidel";
+    default:
+        return "Jacobi";
+    }
+}
 
-P3D ParticleSystem::getPositionOf(int i) {
-    return particles[i].x_i;
+template<typename Scalar, typename Kernels>
+P3D ParticleSystemT<Scalar, Kernels>::getPositionOf(int i) {
+    const Vector3 &x = particles.x_i[i];
+    return P3D(x[0], x[1], x[2]);
 }
 
 // Set the position of particle i.
-void ParticleSystem::setPosition(int i, P3D x) {
-    particles[i].x_i = x;
-    particles[i].x_star = x;
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::setPosition(int i, P3D x) {
+    particles.x_i[i] = x.cast<Scalar>();
+    particles.x_star[i] = particles.x_i[i];
+    drawBufferFilled = false;
 }
 
 // Set the velocity of particle i.
-void ParticleSystem::setVelocity(int i, V3D v) {
-    particles[i].v_i = v;
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::setVelocity(int i, V3D v) {
+    particles.v_i[i] = v.cast<Scalar>();
 }
 
-int ParticleSystem::particleCount() {
+template<typename Scalar, typename Kernels>
+int ParticleSystemT<Scalar, Kernels>::particleCount() {
     return particles.size();
 }
 
@@ -100,223 +152,1116 @@ const V3D GRAVITY = V3D(0, -9.8, 0);
 
 // Applies external forces to particles in the system.
 // This is currently limited to just gravity.
-void ParticleSystem::applyForces(double delta) {
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::applyForces(double delta) {
     if (enableGravity) {
         // Assume all particles have unit mass to simplify calculations.
-        for (auto &p : particles) {
-            p.v_i += (GRAVITY * delta);
+        Vector3 dv = (GRAVITY * delta).cast<Scalar>();
+        forEachParticle([&](int i) {
+            particles.v_i[i] += dv;
+        });
+    }
+}
+
+// Integrate one time step, split into params.substeps substeps that each predict, solve and update
+// the velocities with a fraction of delta. The neighbor lists are built with substepMargin as the
+// skin, and checked at every substep after the first, which rebuilds them (and the solver graphs)
+// when they expired.
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::integrate_PBF(double delta) {
+    Timer stepTimer;
+    Timer timer;
+
+    if (params != activeParams) {
+        applyParams();
+    }
+    reorderedLastStep = false;
+    stepCount++;
+    symmetricStep = symmetricPairs && solverAcceleration != GAUSS_SEIDEL_SOLVER;
+    int substepCount = max(activeParams.substeps, 1);
+    double substep = delta / substepCount;
+    searchSkin = substepCount > 1 ? substepMargin : neighborSkin;
+    complianceScale = activeParams.compliance / (substep * substep);
+    pool.setThreadCount(threadCount);
+    threadScratch.resize(pool.threadCount());
+    stats.threads = pool.threadCount();
+    stats.substeps = substepCount;
+    stats.substepRebuilds = 0;
+    if (reorderInterval > 0 && stepCount % reorderInterval == 0) {
+        reorderParticles();
+    }
+
+    stats.kernelFamily = Kernels::family;
+    stats.kernelSimd = min(kernelSimd, hostSimdLevel());
+    stats.kernelLanes = simdLaneCount(stats.kernelSimd, sizeof(Scalar));
+    for (ThreadScratch &scratch : threadScratch) {
+        scratch.kernelEvaluations = 0;
+    }
+    stats.tasks.clear();
+    stats.threadBusyTimes.assign(pool.threadCount(), 0);
+    stats.graphTime = 0;
+    stats.solverIterations = 0;
+    stats.densityErrors.clear();
+    stats.correctionSizes.clear();
+    stats.iterationTimes.clear();
+    stats.spectralRadius = 0;
+    stats.solverTime = 0;
+    stats.velocityUpdateTime = 0;
+
+    // Substeps converge with fewer iterations each, since their constraints start out closer
+    int iterations = substepCount > 1 ? activeParams.substepIterations : activeParams.maxSolverIterations;
+    for (int s = 0; s < substepCount; s++) {
+        applyForces(substep);
+        // Predict positions for this timestep.
+        forEachParticle([&](int i) {
+            particles.x_star[i] = particles.x_i[i] + (particles.v_i[i] * (Scalar)substep);
+        });
+
+        if (s == 0) {
+            // Find neighbors for all particles.
+            timer.restart();
+            updateNeighbors();
+            stats.neighborSearchTime = timer.timeEllapsed() * 1000;
+            stats.meanNeighborSpan = computeMeanNeighborSpan();
+            buildSolverGraphs();
+        } else if (neighborListsExpired()) {
+            // Some particle moved further than half the margin since the lists were built
+            timer.restart();
+            rebuildNeighbors();
+            stats.neighborSearchTime += timer.timeEllapsed() * 1000;
+            stats.substepRebuilds++;
+            buildSolverGraphs();
+        }
+
+        string prefix = substepCount > 1 ? " " + to_string(s + 1) + "." : " ";
+        double solveStart = stats.graphTime;
+        if (warmStart && lambdaConstraint == (int)xpbdConstraint) {
+            warmStarting = true;
+            pairKernelsCached = cachePairs;
+            relaxation = 1;
+            runGraph(warmStartGraph, prefix + "0");
+            warmStarting = false;
+        } else if (xpbdConstraint) {
+            forEachParticle([&](int i) {
+                particles.lambda_sum[i] = 0;
+            });
         }
+        bool moved = solveConstraints(iterations, prefix);
+        lambdaConstraint = xpbdConstraint;
+        stats.solverTime += stats.graphTime - solveStart;
+
+        double velocityStart = stats.graphTime;
+        bool lastSubstep = s == substepCount - 1;
+        buildVelocityGraph(substep, moved, lastSubstep);
+        runGraph(velocityGraph, substepCount > 1 ? " " + to_string(s + 1) : "");
+        stats.velocityUpdateTime += stats.graphTime - velocityStart;
+        pairKernelsCached = false;
+    }
+    stats.relaxation = relaxation;
+    stats.maxSpeed = sqrt(*max_element(speedParts.begin(), speedParts.end()));
+    drawBufferFilled = true;
+
+    stats.kernelEvaluations = 0;
+    for (const ThreadScratch &scratch : threadScratch) {
+        stats.kernelEvaluations += scratch.kernelEvaluations;
     }
+    if (logIterations) {
+        logSolverIterations();
+    }
+    stats.stepTime = stepTimer.timeEllapsed() * 1000;
+}
+
+// Takes over the current params, and recomputes the kernels and the constants derived from them.
+// The neighbor lists expire by themselves when kernelH changed, since their radius no longer
+// matches.
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::applyParams() {
+    activeParams = params;
+    densityKernel = DensityKernel(activeParams.kernelH);
+    gradientKernel = GradientKernel(activeParams.kernelH);
+    kernelCoefficients = kernelBatchCoefficients<Kernels, Scalar>(activeParams.kernelH);
+    // W(deltaQ) vanishes at the edge of the support, and the tensile correction is then left
+    // out rather than normalized by zero
+    Scalar wDeltaQ = densityKernel(Vector3((Scalar)(activeParams.tensileDeltaQ * activeParams.kernelH), 0, 0));
+    corrNormalization = wDeltaQ > 0 ? 1 / wDeltaQ : 0;
 }
 
-// Integrate one time step.
-void ParticleSystem::integrate_PBF(double delta) {
-    applyForces(delta);
-    // Predict positions for this timestep.
-    for (auto &p : particles) {
-        p.x_star = p.x_i + (p.v_i * delta);
+// Runs up to the given number of solver iterations on the predicted positions, with prefix and
+// the iteration number added to the task names. Returns false if the solver stopped early, in
+// which case the kernels cached by its last density pass are still those of the final positions.
+template<typename Scalar, typename Kernels>
+bool ParticleSystemT<Scalar, Kernels>::solveConstraints(int iterations, const string &prefix) {
+    // Every task that reads the kernels depends on a task that caches them
+    pairKernelsCached = cachePairs;
+    int maxIterations = max(iterations, 1);
+    for (int iteration = 0; iteration < maxIterations; iteration++) {
+        string suffix = prefix + to_string(iteration + 1);
+        runGraph(densityGraph, suffix);
+        double error = 0;
+        for (double partError : densityErrorParts) {
+            error += partError;
+        }
+        error /= max(particles.size(), 1);
+        stats.densityErrors.push_back(error);
+        if (iteration >= activeParams.minSolverIterations && activeParams.solverTolerance > 0
+            && error <= activeParams.solverTolerance) {
+            return false;
+        }
+        relaxation = nextRelaxation(iteration);
+        runGraph(correctionGraph, suffix);
+        double correction = 0;
+        for (double partCorrection : correctionParts) {
+            correction += partCorrection;
+        }
+        stats.correctionSizes.push_back(sqrt(correction / max(particles.size(), 1)));
+        stats.iterationTimes.push_back(stats.graphTime);
+        stats.solverIterations++;
     }
+    return true;
+}
 
-    // Find neighbors for all particles.
-    particleMap.clear();
-    for (int i = 0; i < particles.size(); i++) {
-        particleMap.add(i, particles[i]);
+// The factor the corrections of the given iteration (counted from 0) are applied with.
+// Chebyshev acceleration runs CHEBYSHEV_DELAY plain iterations first, and estimates the spectral
+// radius of the iteration from how fast their corrections shrink, anew for every substep.
+template<typename Scalar, typename Kernels>
+double ParticleSystemT<Scalar, Kernels>::nextRelaxation(int iteration) {
+    if (solverAcceleration == SOR_SOLVER) {
+        return sorFactor;
     }
+    if (solverAcceleration != CHEBYSHEV_SOLVER) {
+        return 1;
+    }
+
+    int delay = max(CHEBYSHEV_DELAY, 2);
+    if (iteration < delay) {
+        return 1;
+    }
+    if (iteration == delay) {
+        // The corrections of the current substep are the last ones
+        const vector<double> &sizes = stats.correctionSizes;
+        int first = (int)sizes.size() - iteration;
+        double ratio = sizes[first + delay - 2] > 0 ? sizes[first + delay - 1] / sizes[first + delay - 2] : 0;
+        stats.spectralRadius = min(ratio, CHEBYSHEV_MAX_RADIUS);
+    }
+    double rho2 = stats.spectralRadius * stats.spectralRadius;
+    return iteration == delay ? 2 / (2 - rho2) : 4 / (4 - rho2 * relaxation);
+}
 
-    for (auto &p_i : particles) {
-        particleMap.findNeighbors(p_i, particles);
+// Writes the iterations the solver took this step, and the density error before each of
+// them, to the log.
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::logSolverIterations() {
+    string errors;
+    for (double error : stats.densityErrors) {
+        char value[32];
+        snprintf(value, sizeof(value), " %.8f", error);
+        errors += value;
     }
+    Logger::logPrint("step %d: %d solver iterations, density error%s\n", stepCount, stats.solverIterations, errors.c_str());
+}
 
-    // TODO: implement the solver loop.
-    int iter = 0;
-    while (iter++ < SOLVER_ITERATIONS) {
-        for (int i = 0; i < particles.size(); i++) {
-            // Update lambda
-            particles[i].lambda_i = getLambda(i);
+// Interleaves the low 21 bits of v so that they occupy every third bit.
+static uint64_t spreadBits(uint64_t v) {
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffULL;
+    v = (v | v << 16) & 0x1f0000ff0000ffULL;
+    v = (v | v << 8) & 0x100f00f00f00f00fULL;
+    v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+    v = (v | v << 2) & 0x1249249249249249ULL;
+    return v;
+}
+
+// Permutes the particles so that they are sorted along a Morton (Z-order) curve over grid
+// cells of size kernelH. Particles that are close in space then end up close in memory,
+// which keeps the neighbor loops of the solver in cache.
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::reorderParticles() {
+    int n = particles.size();
+    if (n == 0) return;
+
+    Vector3 minCorner = particles.x_i[0];
+    for (const Vector3 &x : particles.x_i) {
+        for (int axis = 0; axis < 3; axis++) {
+            minCorner[axis] = min(minCorner[axis], x[axis]);
         }
+    }
 
-        for (int i = 0; i < particles.size(); i++) {
-            // Calculate change in position
-            particles[i].delta_p = getDeltaP(i);
+    vector<pair<uint64_t, int>> keys(n);
+    for (int i = 0; i < n; i++) {
+        uint64_t code = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            uint64_t cell = (uint64_t)((particles.x_i[i][axis] - minCorner[axis]) / activeParams.kernelH);
+            code |= spreadBits(cell) << axis;
         }
+        keys[i] = make_pair(code, i);
+    }
+    sort(keys.begin(), keys.end());
+
+    stats.spanBeforeReorder = computeMeanNeighborSpan();
 
-        for (auto &p_i : particles) {
-            // Update predicted position
-            p_i.x_star += p_i.delta_p;
+    newIndexOf.resize(n);
+    for (int k = 0; k < n; k++) {
+        newIndexOf[keys[k].second] = k;
+    }
+
+    vector<int> order(n);
+    for (int k = 0; k < n; k++) {
+        order[k] = keys[k].second;
+    }
+    particles.permute(order);
+
+    if (neighbors.particleCount() == n) {
+        NeighborList remapped;
+        remapped.build(n, [&](int k, vector<int> &out) {
+            int i = keys[k].second;
+            for (const int *j = neighbors.begin(i); j != neighbors.end(i); j++) {
+                out.push_back(newIndexOf[*j]);
+            }
+        });
+        swap(neighbors, remapped);
+    }
+
+    // Keep the neighbor lists valid by permuting their reference positions as well
+    if ((int)neighborBuildPositions.size() == n) {
+        AlignedVector<Vector3> buildPositions(n);
+        for (int k = 0; k < n; k++) {
+            buildPositions[k] = neighborBuildPositions[keys[k].second];
         }
+        neighborBuildPositions.swap(buildPositions);
+    }
+    colorsBuilt = false;
+    // The search structures remember particles by index, so they have to start over
+    particleMap.clear();
+    particleGrid.clear();
+    particleHash.clear();
+    reorderedLastStep = true;
 
-        for (int i = 0; i < particles.size(); i++) {
-            for (CollisionPlane cp_i : planes) {
-                // Collision detection and response
-                particles[i].x_star = cp_i.handleCollision(particles[i]);
+    stats.spanAfterReorder = computeMeanNeighborSpan();
+    stats.reorderCount++;
+}
+
+template<typename Scalar, typename Kernels>
+double ParticleSystemT<Scalar, Kernels>::computeMeanNeighborSpan() {
+    vector<double> threadSpan(pool.threadCount());
+    pool.forEachRange(neighbors.particleCount(), [&](int begin, int end, int t) {
+        double span = 0;
+        for (int i = begin; i < end; i++) {
+            for (const int *j = neighbors.begin(i); j != neighbors.end(i); j++) {
+                span += abs(i - *j);
             }
         }
+        threadSpan[t] = span;
+    });
+    double span = 0;
+    for (double s : threadSpan) {
+        span += s;
     }
-    for (int i = 0; i < particles.size(); i++) {
-        particles[i].v_i = (particles[i].x_star - particles[i].x_i) / delta;
+    return neighbors.pairCount() > 0 ? span / neighbors.pairCount() : 0;
+}
+
+template<typename Scalar, typename Kernels>
+NeighborSearch* ParticleSystemT<Scalar, Kernels>::getNeighborSearch() {
+    switch (neighborBackend) {
+    case SPATIAL_MAP_BACKEND:
+        return &particleMap;
+    case SPATIAL_HASH_BACKEND:
+        return &particleHash;
+    default:
+        return &particleGrid;
     }
-    for (int i = 0; i < particles.size(); i++) {
-        particles[i].vorticity_W = getVorticityW(i);
+}
+
+// Returns true if the neighbor lists may be missing pairs that are now within kernelH.
+template<typename Scalar, typename Kernels>
+bool ParticleSystemT<Scalar, Kernels>::neighborListsExpired() {
+    // The brute-force reference rebuilds every step. It uses the same radius as the fast path,
+    // so that both hand exactly the same pairs to the solver.
+    int mode = bruteForceNeighbors ? -1 : neighborBackend;
+    if (bruteForceNeighbors || mode != neighborBuildMode || symmetricStep != neighborBuildSymmetric
+        || neighborBuildRadius != activeParams.kernelH + searchSkin
+        || (int)neighborBuildPositions.size() != particles.size()) {
+        return true;
     }
-    for (int i = 0; i < particles.size(); i++) {
-        particles[i].vorticity_N = getVorticityN(i);
-        V3D vorticity_F = (particles[i].vorticity_N.cross(particles[i].vorticity_W)) * VORTICITY_EPSILON;
-        particles[i].v_i += vorticity_F * delta;
+
+    // Two particles that each moved less than skin / 2 cannot have closed a gap larger than the skin
+    double maxDisplacement2 = searchSkin * searchSkin / 4;
+    vector<char> threadExpired(pool.threadCount(), 0);
+    pool.forEachRange(particles.size(), [&](int begin, int end, int t) {
+        for (int i = begin; i < end; i++) {
+            if ((particles.x_star[i] - neighborBuildPositions[i]).squaredNorm() > maxDisplacement2) {
+                threadExpired[t] = 1;
+                return;
+            }
+        }
+    });
+    return find(threadExpired.begin(), threadExpired.end(), 1) != threadExpired.end();
+}
+
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::updateNeighbors() {
+    stats.steps++;
+    if (!neighborListsExpired()) {
+        stats.stepsSinceRebuild++;
+        return;
     }
 
-    int particle_index = 0;
-    for (auto &p : particles) {
-        // TODO: edit this loop to apply vorticity and viscosity.
-        // p.v_i = (p.x_star - p.x_i) / delta;
+    rebuildNeighbors();
+    stats.neighborRebuilds++;
+    stats.stepsSinceRebuild = 0;
+}
 
-        // Apply vorticity
-        // V3D vorticity_F = (p.vorticity_N.cross(p.vorticity_W)) * VORTICITY_EPSILON;
-        // p.v_i += vorticity_F * delta;
-        //cout << vorticity_F * delta << "   " << GRAVITY * delta << "\n";
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::rebuildNeighbors() {
+    double radius = activeParams.kernelH + searchSkin;
+    findNeighbors(radius);
+
+    neighborBuildMode = bruteForceNeighbors ? -1 : neighborBackend;
+    neighborBuildSymmetric = symmetricStep;
+    neighborBuildRadius = radius;
+    neighborBuildPositions.resize(particles.size());
+    forEachParticle([&](int i) {
+        neighborBuildPositions[i] = particles.x_star[i];
+    });
+    colorsBuilt = false;
+}
 
-        // Apply viscosity
-        p.v_i += getXSPH(particle_index);
+// Rebuilds the neighbor list of every particle from the predicted positions.
+// With symmetricStep on, each pair is only stored in the list of one of its particles.
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::findNeighbors(double radius) {
+    searchPositions.resize(particles.size());
+    forEachParticle([&](int i) {
+        const Vector3 &x = particles.x_star[i];
+        searchPositions[i] = P3D(x[0], x[1], x[2]);
+    });
+
+    if (bruteForceNeighbors) {
+        neighbors.build(particles.size(), [&](int i, vector<int> &out) {
+            findNeighborsBruteForce(i, radius, symmetricStep, out);
+        }, pool);
+        return;
+    }
 
-        p.x_i = p.x_star;
+    NeighborSearch *search = getNeighborSearch();
+    search->setRadius(radius);
+    bool rebuilt;
+    stats.cellChanges = search->update(searchPositions, maxCellChurn, rebuilt);
+    stats.cellChurn = particles.empty() ? 0 : (double)stats.cellChanges / particles.size();
+    if (rebuilt) {
+        stats.searchRebuilds++;
+    } else {
+        stats.searchUpdates++;
+    }
 
-        particle_index++;
+    neighbors.build(particles.size(), [&](int i, vector<int> &out) {
+        if (symmetricStep) {
+            search->findHalfNeighbors(i, searchPositions, out);
+        } else {
+            search->findNeighbors(i, searchPositions, out);
+        }
+    }, pool);
+}
+
+// Reference neighbor search: tests particle i against every other particle,
+// or only against the ones with a larger index when building half lists.
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::findNeighborsBruteForce(int i, double radius, bool half, vector<int> &out) {
+    const P3D &x_i = searchPositions[i];
+
+    for (int j = half ? i + 1 : 0; j < particles.size(); j++) {
+        V3D j_to_i = x_i - searchPositions[j];
+        if (j_to_i.length2() < radius * radius) {
+            out.push_back(j);
+        }
     }
 }
 
-double ParticleSystem::getLambda(int i) {
+template<typename Scalar, typename Kernels>
+Scalar ParticleSystemT<Scalar, Kernels>::getLambda(int i) {
     double c = getC(i);
 
+    // The gradient of C_i with respect to each neighbor x_k, and with respect to x_i itself,
+    // which is in its own list
     double grad_sum = 0.0;
-    for (int k : particles[i].neighbors) {
-        V3D grad_c = getGradC(i, k);
-        grad_sum += grad_c.length2();
-    }
+    Vector3 grad_self = Vector3::Zero();
+    forEachNeighbor(i, [&](int, const PairKernels &kernels) {
+        Vector3 grad_c = -kernels.gradW / (Scalar)activeParams.restDensity;
+        grad_sum += (double)grad_c.squaredNorm();
+        grad_self -= kernels.gradW;
+    });
+    grad_self /= (Scalar)activeParams.restDensity;
+    grad_sum += (double)grad_self.squaredNorm();
+
+    return solveLambda(i, c, grad_sum);
+}
 
-    return -c / (grad_sum + CFM_EPSILON);
+// The lambda of particle i given its constraint c and the sum of its squared gradients. PBF
+// softens the constraint by cfmEpsilon. XPBD solves for the change of the lambda accumulated
+// over the iterations of the step, with a compliance scaled by the time step, so that the
+// stiffness does not depend on the step or the iteration count. The change is only added to
+// the accumulated lambda once the corrections it gives are applied.
+template<typename Scalar, typename Kernels>
+Scalar ParticleSystemT<Scalar, Kernels>::solveLambda(int i, double c, double gradSum) {
+    if (!xpbdConstraint) {
+        return (Scalar)(-c / (gradSum + activeParams.cfmEpsilon));
+    }
+    return (Scalar)((-c - complianceScale * particles.lambda_sum[i]) / (gradSum + complianceScale));
 }
 
-double ParticleSystem::getC(int i) {
-    particles[i].density = getDensity(i);
-    // cout << particles[i].density << "\n";
+template<typename Scalar, typename Kernels>
+double ParticleSystemT<Scalar, Kernels>::getC(int i) {
+    particles.density[i] = getDensity(i);
+    // cout << particles.density[i] << "\n";
 
-    return (particles[i].density / rd) - 1.0;
+    return (particles.density[i] / activeParams.restDensity) - 1.0;
 }
 
-double ParticleSystem::getDensity(int i) {
+template<typename Scalar, typename Kernels>
+double ParticleSystemT<Scalar, Kernels>::getDensity(int i) {
     double density = 0.0;
-    for (int j = 0; j < particles.size(); j++) {
-        V3D j_to_i = particles[i].x_star - particles[j].x_star;
-        density += poly6(j_to_i, KERNEL_H);
-    }
+    forEachNeighbor(i, [&](int, const PairKernels &kernels) {
+        density += kernels.w;
+    });
 
     return density;
 }
 
-V3D ParticleSystem::getGradC(int i, int k) {
-    V3D grad_c = V3D();
+template<typename Scalar, typename Kernels>
+typename ParticleSystemT<Scalar, Kernels>::Vector3 ParticleSystemT<Scalar, Kernels>::getDeltaP(int i) {
+    Vector3 delta_p = Vector3::Zero();
+
+    forEachNeighbor(i, [&](int j, const PairKernels &kernels) {
+        Scalar coeff = particles.lambda_i[i] + particles.lambda_i[j] + getCorr(kernels.w);
+        Vector3 term = -kernels.gradW;
+
+        delta_p += term * coeff;
+    });
+
+    return delta_p / (Scalar)activeParams.restDensity;
+}
+
+// The tensile correction of a pair. The warm start only applies the multipliers.
+template<typename Scalar, typename Kernels>
+Scalar ParticleSystemT<Scalar, Kernels>::getCorr(Scalar w) {
+    if (warmStarting) {
+        return 0;
+    }
+    Scalar ratio = w * corrNormalization;
+    Scalar power = 1;
+    for (int k = 0; k < activeParams.tensileN; k++) {
+        power *= ratio;
+    }
+    return (Scalar)-activeParams.tensileK * power;
+}
+
+template<typename Scalar, typename Kernels>
+typename ParticleSystemT<Scalar, Kernels>::Vector3 ParticleSystemT<Scalar, Kernels>::getVorticityW(int i) {
+    Vector3 vorticity = Vector3::Zero();
+    forEachNeighbor(i, [&](int j, const PairKernels &kernels) {
+        Vector3 rel_vel = particles.v_i[j] - particles.v_i[i];
+        Vector3 smoothing = -kernels.gradW;
+
+        vorticity += rel_vel.cross(smoothing);
+    });
+
+    return vorticity;
+}
+
+template<typename Scalar, typename Kernels>
+typename ParticleSystemT<Scalar, Kernels>::Vector3 ParticleSystemT<Scalar, Kernels>::getVorticityN(int i) {
+    Vector3 grad_w = getGradW(i);
+    return grad_w / (grad_w.norm() + (Scalar)1e-20);
+}
+
+template<typename Scalar, typename Kernels>
+typename ParticleSystemT<Scalar, Kernels>::Vector3 ParticleSystemT<Scalar, Kernels>::getGradW(int i) {
+    Vector3 grad_w = Vector3::Zero();
+    forEachNeighbor(i, [&](int j, const PairKernels &kernels) {
+        Scalar diff_w = particles.vorticity_W[j].norm() - particles.vorticity_W[i].norm();
+        Scalar diff_p = kernels.distance + (Scalar)1e-20;
+
+        grad_w -= kernels.gradW * (diff_w / diff_p);
+    });
 
-    if (i == k) {
-        for (int j : particles[i].neighbors) {
-            V3D j_to_i = particles[i].x_star - particles[j].x_star;
-            grad_c += spiky(j_to_i, KERNEL_H, false);
+    return grad_w;
+}
+
+template<typename Scalar, typename Kernels>
+typename ParticleSystemT<Scalar, Kernels>::Vector3 ParticleSystemT<Scalar, Kernels>::getXSPH(int i) {
+    Vector3 delta_v = Vector3::Zero();
+
+    forEachNeighbor(i, [&](int j, const PairKernels &kernels) {
+        Vector3 rel_vel = particles.v_i[j] - particles.v_i[i];
+        delta_v += rel_vel * kernels.w;
+    });
+
+    return delta_v * (Scalar)activeParams.viscosityC;
+}
+
+// Builds the graphs the rest of the step runs as, once the neighbor lists are up to date.
+// Each solver iteration runs densityGraph, which measures the density error, and unless that
+// is small enough, correctionGraph, which moves the particles. With warmStart on, each substep
+// first runs warmStartGraph, which moves them by the damped multipliers of the previous one.
+// Tasks that do not depend on each other can overlap (caching the kernels and clearing the sums;
+// vorticity, XSPH and the draw buffer at the end), and idle threads steal ranges of whatever is
+// ready.
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::buildSolverGraphs() {
+    int n = particles.size();
+    int parts = pool.threadCount();
+
+    pairKernels.resize(neighbors.pairCount());
+    pairNeighbors.resize(neighbors.pairCount());
+    pairEnds.resize(n);
+    pairGradSelf.resize(n);
+    pairGradSq.resize(n);
+    pairGradW.resize(n);
+    xsphDelta.resize(n);
+    densityErrorParts.resize(parts);
+    correctionParts.resize(parts);
+    if (solverAcceleration == CHEBYSHEV_SOLVER) {
+        previousXStar.resize(n);
+    }
+    if (symmetricStep) {
+        densityScatter.begin(particles.density.data(), n, parts, 0.0);
+        gradSelfScatter.begin(pairGradSelf.data(), n, parts, Vector3d::Zero());
+        gradSqScatter.begin(pairGradSq.data(), n, parts, 0.0);
+        deltaPScatter.begin(particles.delta_p.data(), n, parts, Vector3::Zero());
+        vorticityScatter.begin(particles.vorticity_W.data(), n, parts, Vector3::Zero());
+        gradWScatter.begin(pairGradW.data(), n, parts, Vector3::Zero());
+        xsphScatter.begin(xsphDelta.data(), n, parts, Vector3::Zero());
+    }
+
+    densityGraph.clear();
+    int cache = -1;
+    if (cachePairs) {
+        cache = densityGraph.addTask("cache kernels", n, TASK_GRAIN, [this](int begin, int end, int) {
+            cachePairKernels(begin, end);
+        });
+    }
+    int lambda;
+    if (symmetricStep) {
+        int clear = densityGraph.addTask("clear sums", n, TASK_GRAIN, [this](int begin, int end, int) {
+            clearSolverSums(begin, end);
+        });
+        int lambdaTerms = densityGraph.addPartitionedTask("lambda terms", n, parts, [this](int begin, int end, int part) {
+            sumLambdaTerms(begin, end, part);
+        });
+        densityGraph.addDependency(lambdaTerms, cache);
+        densityGraph.addDependency(lambdaTerms, clear);
+        lambda = densityGraph.addTask("lambda", n, TASK_GRAIN, [this](int begin, int end, int) {
+            computeLambdas(begin, end);
+        });
+        densityGraph.addDependency(lambda, lambdaTerms);
+    } else {
+        lambda = densityGraph.addTask("lambda", n, TASK_GRAIN, [this](int begin, int end, int) {
+            for (int i = begin; i < end; i++) {
+                particles.lambda_i[i] = getLambda(i);
+            }
+        });
+        densityGraph.addDependency(lambda, cache);
+    }
+    // Partitioned so that the sum does not depend on which thread ran which range
+    int error = densityGraph.addPartitionedTask("density error", n, parts, [this](int begin, int end, int part) {
+        densityErrorParts[part] = sumDensityError(begin, end);
+    });
+    densityGraph.addDependency(error, lambda);
+
+    warmStartGraph.clear();
+    if (warmStart) {
+        int warmCache = -1;
+        if (cachePairs) {
+            warmCache = warmStartGraph.addTask("cache kernels", n, TASK_GRAIN, [this](int begin, int end, int) {
+                cachePairKernels(begin, end);
+            });
         }
+        int warmLambdas = warmStartGraph.addTask("warm lambdas", n, TASK_GRAIN, [this](int begin, int end, int) {
+            warmStartLambdas(begin, end);
+        });
+        addCorrectionTasks(warmStartGraph, warmLambdas, warmCache);
+    }
+
+    correctionGraph.clear();
+    if (solverAcceleration == GAUSS_SEIDEL_SOLVER) {
+        buildGaussSeidelSweep();
+        return;
+    }
+    addCorrectionTasks(correctionGraph, -1, -1);
+}
+
+// Adds the tasks that sum up delta_p from the lambdas and move the particles by it, after the
+// given tasks that compute the lambdas and cache the kernels (-1 for none). Returns the last one.
+template<typename Scalar, typename Kernels>
+int ParticleSystemT<Scalar, Kernels>::addCorrectionTasks(TaskGraph &graph, int lambdas, int cache) {
+    int n = particles.size();
+    int parts = pool.threadCount();
+    int deltaP;
+    if (symmetricStep) {
+        deltaP = graph.addPartitionedTask("delta p", n, parts, [this](int begin, int end, int part) {
+            sumDeltaP(begin, end, part);
+        });
     } else {
-        V3D k_to_i = particles[i].x_star - particles[k].x_star;
-        grad_c = -spiky(k_to_i, KERNEL_H, true);
+        deltaP = graph.addTask("delta p", n, TASK_GRAIN, [this](int begin, int end, int) {
+            for (int i = begin; i < end; i++) {
+                particles.delta_p[i] = getDeltaP(i);
+            }
+        });
     }
+    graph.addDependency(deltaP, lambdas);
+    graph.addDependency(deltaP, cache);
+    // Partitioned, so that the size of the corrections sums up the same on every run
+    int positions = graph.addPartitionedTask("positions", n, parts, [this](int begin, int end, int part) {
+        correctionParts[part] = applyDeltaP(begin, end);
+    });
+    graph.addDependency(positions, deltaP);
+    return positions;
+}
 
-    return grad_c / rd;
+// The corrections of a Gauss-Seidel iteration, as one task per color that depends on the
+// previous one. The cells of a color are far enough apart that no particle of one is in the
+// neighbor list of a particle of another, so they can be swept concurrently, while the particles
+// of a cell are corrected one after the other. Either way the result does not depend on which
+// thread ran what.
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::buildGaussSeidelSweep() {
+    if (!colorsBuilt) {
+        buildColors();
+    }
+
+    int previous = -1;
+    for (int color = 0; color < GAUSS_SEIDEL_COLORS; color++) {
+        int first = colorFirstCell[color];
+        int cells = colorFirstCell[color + 1] - first;
+        int task = correctionGraph.addTask("color " + to_string(color), cells, GAUSS_SEIDEL_GRAIN, [this, first](int begin, int end, int) {
+            for (int cell = first + begin; cell < first + end; cell++) {
+                for (int k = colorCellStarts[cell]; k < colorCellStarts[cell + 1]; k++) {
+                    solveGaussSeidel(colorOrder[k]);
+                }
+            }
+        });
+        correctionGraph.addDependency(task, previous);
+        previous = task;
+    }
+
+    int parts = pool.threadCount();
+    int correction = correctionGraph.addPartitionedTask("correction size", particles.size(), parts, [this](int begin, int end, int part) {
+        double sum = 0;
+        for (int i = begin; i < end; i++) {
+            sum += particles.delta_p[i].template cast<double>().squaredNorm();
+        }
+        correctionParts[part] = sum;
+    });
+    correctionGraph.addDependency(correction, previous);
 }
 
-V3D ParticleSystem::getDeltaP(int i) {
-    V3D delta_p = V3D();
+// Colors the particles by the parity of the cell they were in when the neighbor lists were
+// built, with cells as wide as the search radius: two particles of the same color in different
+// cells were at least that far apart, so neither is in the other's list. colorOrder holds the
+// particles sorted by color and then cell, and the particles of cell c are
+// colorOrder[colorCellStarts[c] ... colorCellStarts[c + 1] - 1].
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::buildColors() {
+    int n = particles.size();
+    vector<pair<uint64_t, int>> keys(n);
+    forEachParticle([&](int i) {
+        uint64_t key = 0;
+        int color = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            int64_t cell = (int64_t)floor(neighborBuildPositions[i][axis] / neighborBuildRadius);
+            color |= (int)(cell & 1) << axis;
+            key = (key << 20) | (uint64_t)((cell + (1 << 19)) & 0xFFFFF);
+        }
+        keys[i] = make_pair(((uint64_t)color << 60) | key, i);
+    });
+    sort(keys.begin(), keys.end());
+
+    colorOrder.resize(n);
+    colorCellStarts.clear();
+    colorFirstCell.assign(GAUSS_SEIDEL_COLORS + 1, 0);
+    for (int k = 0; k < n; k++) {
+        colorOrder[k] = keys[k].second;
+        if (k == 0 || keys[k].first != keys[k - 1].first) {
+            colorFirstCell[(keys[k].first >> 60) + 1]++;
+            colorCellStarts.push_back(k);
+        }
+    }
+    colorCellStarts.push_back(n);
+    for (int color = 0; color < GAUSS_SEIDEL_COLORS; color++) {
+        colorFirstCell[color + 1] += colorFirstCell[color];
+    }
+    colorsBuilt = true;
+}
 
-    for (int j : particles[i].neighbors) {
-        double coeff = particles[i].lambda_i + particles[j].lambda_i + getCorr(i, j);
-        V3D j_to_i = particles[i].x_star - particles[j].x_star;
-        V3D term = spiky(j_to_i, KERNEL_H, false);
+// Projects the density constraint of particle i alone, from the current positions of its
+// neighbors and their latest lambdas, and moves it right away.
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::solveGaussSeidel(int i) {
+    // Neighbors swept before i have moved since the kernels were cached. Only i reads its own
+    // pairs, so they can be brought up to date here; the next iteration caches all of them anew.
+    if (pairKernelsCached) {
+        cachePairKernels(i, i + 1);
+    }
+    particles.lambda_i[i] = getLambda(i);
+    particles.delta_p[i] = getDeltaP(i);
+    if (xpbdConstraint) {
+        particles.lambda_sum[i] += particles.lambda_i[i];
+    }
+    particles.x_star[i] += particles.delta_p[i];
+    for (const CollisionPlane &cp_i : planes) {
+        particles.x_star[i] = cp_i.handleCollision(particles.x_i[i], particles.x_star[i]);
+    }
+}
 
-        delta_p += term * coeff;
+// The velocity update. The kernels only need to be cached again if the particles moved since
+// densityGraph last ran, and the draw buffer only needs the positions of the last substep.
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::buildVelocityGraph(double delta, bool cacheKernels, bool draw) {
+    int n = particles.size();
+    int parts = pool.threadCount();
+    velocityGraph.clear();
+
+    int velocity = velocityGraph.addTask("velocity", n, TASK_GRAIN, [this, delta](int begin, int end, int) {
+        updateVelocities(begin, end, delta);
+    });
+    if (draw) {
+        velocityGraph.addTask("draw buffer", n, TASK_GRAIN, [this](int begin, int end, int) {
+            fillDrawBuffer(begin, end);
+        });
+    }
+    int cache = -1;
+    if (cachePairs && cacheKernels) {
+        cache = velocityGraph.addTask("cache kernels", n, TASK_GRAIN, [this](int begin, int end, int) {
+            cachePairKernels(begin, end);
+        });
     }
 
-    return delta_p / rd;
+    // Vorticity and viscosity are both computed from the velocities the solver left
+    int vorticityW, vorticityN, xsph;
+    if (symmetricStep) {
+        vorticityW = velocityGraph.addPartitionedTask("vorticity", n, parts, [this](int begin, int end, int part) {
+            sumVorticityW(begin, end, part);
+        });
+        int reduceW = velocityGraph.addTask("reduce vorticity", n, TASK_GRAIN, [this](int begin, int end, int) {
+            vorticityScatter.reduceRange(begin, end);
+        });
+        velocityGraph.addDependency(reduceW, vorticityW);
+        vorticityN = velocityGraph.addPartitionedTask("vorticity gradient", n, parts, [this](int begin, int end, int part) {
+            sumVorticityGradient(begin, end, part);
+        });
+        velocityGraph.addDependency(vorticityN, reduceW);
+        xsph = velocityGraph.addPartitionedTask("xsph", n, parts, [this](int begin, int end, int part) {
+            sumXSPH(begin, end, part);
+        });
+    } else {
+        vorticityW = velocityGraph.addTask("vorticity", n, TASK_GRAIN, [this](int begin, int end, int) {
+            for (int i = begin; i < end; i++) {
+                particles.vorticity_W[i] = getVorticityW(i);
+            }
+        });
+        vorticityN = velocityGraph.addTask("vorticity gradient", n, TASK_GRAIN, [this](int begin, int end, int) {
+            for (int i = begin; i < end; i++) {
+                particles.vorticity_N[i] = getVorticityN(i);
+            }
+        });
+        velocityGraph.addDependency(vorticityN, vorticityW);
+        xsph = velocityGraph.addTask("xsph", n, TASK_GRAIN, [this](int begin, int end, int) {
+            for (int i = begin; i < end; i++) {
+                xsphDelta[i] = getXSPH(i);
+            }
+        });
+    }
+    velocityGraph.addDependency(vorticityW, velocity);
+    velocityGraph.addDependency(vorticityW, cache);
+    velocityGraph.addDependency(xsph, velocity);
+    velocityGraph.addDependency(xsph, cache);
+
+    int apply = velocityGraph.addTask("apply vorticity and xsph", n, TASK_GRAIN, [this, delta](int begin, int end, int) {
+        applyVorticityAndViscosity(begin, end, delta);
+    });
+    velocityGraph.addDependency(apply, vorticityN);
+    velocityGraph.addDependency(apply, xsph);
+
+    // For choosing the next time step. A maximum does not depend on how the work was split.
+    speedParts.assign(parts, 0);
+    int speed = velocityGraph.addPartitionedTask("max speed", n, parts, [this](int begin, int end, int part) {
+        Scalar speed2 = 0;
+        for (int i = begin; i < end; i++) {
+            speed2 = max(speed2, particles.v_i[i].squaredNorm());
+        }
+        speedParts[part] = (double)speed2;
+    });
+    velocityGraph.addDependency(speed, apply);
 }
 
-double ParticleSystem::getCorr(int i, int j) {
-    V3D j_to_i = particles[i].x_star - particles[j].x_star;
-    double num = poly6(j_to_i, KERNEL_H);
+// Runs one of the graphs of the step and appends its task timings to the stats, offset by
+// when it started and with suffix added to the names.
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::runGraph(TaskGraph &graph, const string &suffix) {
+    double offset = stats.graphTime;
+    graph.run(pool);
+    stats.graphTime += graph.runTime();
+
+    for (TaskTiming task : graph.taskTimings()) {
+        task.name += suffix;
+        task.start += offset;
+        task.end += offset;
+        stats.tasks.push_back(task);
+    }
+    stats.threadBusyTimes.resize(pool.threadCount());
+    for (int t = 0; t < pool.threadCount(); t++) {
+        stats.threadBusyTimes[t] += graph.threadBusyTimes()[t];
+    }
+}
 
-    V3D delta_q = V3D(TENSILE_DELTA_Q, 0.0, 0.0);
-    double denom = poly6(delta_q, KERNEL_H);
+// Evaluates the kernels of every pair in the neighbor lists of the particles in [begin, end)
+// at the current predicted positions. Must be run again whenever they move.
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::cachePairKernels(int begin, int end) {
+    for (int i = begin; i < end; i++) {
+        // The pairs within kernelH are moved to the front of the range of i
+        int count = neighbors.offsets[i];
+        evaluateNeighborKernels(i, [&](int p, const PairKernels &kernels) {
+            if (kernels.w > 0) {
+                pairKernels[count] = kernels;
+                pairNeighbors[count] = neighbors.indices[p];
+                count++;
+            }
+        });
+        pairEnds[i] = count;
+    }
+}
 
-    return -TENSILE_K * pow(num/denom, TENSILE_N);
+// Replaces the lambdas with the damped multipliers of the previous substep, for the correction
+// tasks of the warm start to apply. Under XPBD that is the accumulated lambda, which the warm
+// start then counts as the first lambda of this substep.
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::warmStartLambdas(int begin, int end) {
+    for (int i = begin; i < end; i++) {
+        if (xpbdConstraint) {
+            particles.lambda_i[i] = (Scalar)(activeParams.warmStartDamping * particles.lambda_sum[i]);
+            particles.lambda_sum[i] = 0;
+        } else {
+            particles.lambda_i[i] *= (Scalar)activeParams.warmStartDamping;
+        }
+        if (symmetricStep) {
+            particles.delta_p[i] = Vector3::Zero();
+        }
+    }
 }
 
-double ParticleSystem::poly6(V3D r, double h) {
-    if (r.length() > h) {
-        return 0.0;
+// Symmetric versions of the solver passes. Each visits every pair of neighbors once and
+// scatters the contribution to both particles: W and |grad W| are the same from both sides,
+// and grad W flips sign when i and j are swapped. The part that owns i adds to it directly,
+// and adds to j through a ScatterBuffer.
+
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::clearSolverSums(int begin, int end) {
+    double selfDensity = densityKernel(Vector3::Zero());
+    for (int i = begin; i < end; i++) {
+        particles.density[i] = selfDensity;
+        pairGradSelf[i] = Vector3d::Zero();
+        pairGradSq[i] = 0;
+        particles.delta_p[i] = Vector3::Zero();
     }
+}
 
-    double coeff = 315.0 / 64.0 / PI / pow(h, 9);
-    double term = pow(pow(h, 2) - r.length2(), 3);
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::sumLambdaTerms(int begin, int end, int part) {
+    densityScatter.beginPart(part);
+    gradSelfScatter.beginPart(part);
+    gradSqScatter.beginPart(part);
+    forEachPair(begin, end, [&](int i, int j, const PairKernels &kernels) {
+        double w = kernels.w;
+        particles.density[i] += w;
+        densityScatter.at(part, j) += w;
+
+        // Gradient of C_i with respect to x_j, and its contribution to the gradient wrt x_i
+        Vector3d grad = (-kernels.gradW / (Scalar)activeParams.restDensity).template cast<double>();
+        pairGradSelf[i] += grad;
+        gradSelfScatter.at(part, j) -= grad;
+        pairGradSq[i] += grad.squaredNorm();
+        gradSqScatter.at(part, j) += grad.squaredNorm();
+    });
+}
 
-    return coeff * term;
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::computeLambdas(int begin, int end) {
+    densityScatter.reduceRange(begin, end);
+    gradSelfScatter.reduceRange(begin, end);
+    gradSqScatter.reduceRange(begin, end);
+    for (int i = begin; i < end; i++) {
+        double c = (particles.density[i] / activeParams.restDensity) - 1.0;
+        particles.lambda_i[i] = solveLambda(i, c, pairGradSq[i] + pairGradSelf[i].squaredNorm());
+    }
 }
 
-V3D ParticleSystem::spiky(V3D r, double h, bool wrt_first) {
-    if (r.length() > h) {
-        return V3D();
+// Sum of |C_i| over the particles in [begin, end), from the densities computeLambdas (or
+// getLambda) just left. The constraint is not clamped, so both compression and expansion count.
+template<typename Scalar, typename Kernels>
+double ParticleSystemT<Scalar, Kernels>::sumDensityError(int begin, int end) {
+    double error = 0;
+    for (int i = begin; i < end; i++) {
+        error += fabs(particles.density[i] / activeParams.restDensity - 1.0);
     }
+    return error;
+}
 
-    double coeff = -45.0 / PI / pow(h, 6);
-    double term = pow(h - r.length(), 2);
-    V3D dir = wrt_first ? r.unit() : -r.unit();
+template<typename Scalar, typename Kernels>
+double ParticleSystemT<Scalar, Kernels>::measureDensityError() {
+    int n = particles.size();
+    vector<double> threadError(pool.threadCount(), 0);
+    pool.forEachRange(n, [&](int begin, int end, int t) {
+        for (int i = begin; i < end; i++) {
+            double density = 0;
+            for (int j = 0; j < n; j++) {
+                Vector3 r = particles.x_i[i] - particles.x_i[j];
+                if (r.squaredNorm() < (Scalar)(activeParams.kernelH * activeParams.kernelH)) {
+                    density += densityKernel(r);
+                }
+            }
+            threadError[t] += fabs(density / activeParams.restDensity - 1.0);
+        }
+    });
 
-    return dir * (coeff * term);
+    double error = 0;
+    for (double partError : threadError) {
+        error += partError;
+    }
+    return error / max(n, 1);
 }
 
-V3D ParticleSystem::getVorticityW(int i) {
-    V3D vorticity = V3D();
-    for (int j : particles[i].neighbors) {
-        V3D rel_vel = particles[j].v_i - particles[i].v_i;
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::sumDeltaP(int begin, int end, int part) {
+    deltaPScatter.beginPart(part);
+    forEachPair(begin, end, [&](int i, int j, const PairKernels &kernels) {
+        Scalar coeff = particles.lambda_i[i] + particles.lambda_i[j] + getCorr(kernels.w);
+        Vector3 term = -kernels.gradW * coeff;
+        particles.delta_p[i] += term;
+        deltaPScatter.at(part, j) -= term;
+    });
+}
 
-        V3D j_to_i = particles[i].x_star - particles[j].x_star;
-        V3D smoothing = spiky(j_to_i, KERNEL_H, false);
+// Moves the predicted positions by delta_p, scaled by the relaxation of the iteration, and
+// resolves collisions with the walls. Returns the sum of |delta_p|^2, the size of the unscaled
+// corrections.
+template<typename Scalar, typename Kernels>
+double ParticleSystemT<Scalar, Kernels>::applyDeltaP(int begin, int end) {
+    if (symmetricStep) {
+        deltaPScatter.reduceRange(begin, end);
+        for (int i = begin; i < end; i++) {
+            particles.delta_p[i] /= (Scalar)activeParams.restDensity;
+        }
+    }
 
-        vorticity += rel_vel.cross(smoothing);
+    bool chebyshev = solverAcceleration == CHEBYSHEV_SOLVER;
+    Scalar omega = (Scalar)relaxation;
+    double correction = 0;
+    for (int i = begin; i < end; i++) {
+        if (xpbdConstraint) {
+            particles.lambda_sum[i] += particles.lambda_i[i];
+        }
+        correction += particles.delta_p[i].template cast<double>().squaredNorm();
+        Vector3 x = particles.x_star[i];
+
+        // Update predicted position
+        if (chebyshev && relaxation != 1) {
+            // x_{k+1} = omega (x_k + delta_p - x_{k-1}) + x_{k-1}
+            const Vector3 &older = previousXStar[i];
+            particles.x_star[i] = omega * (x + particles.delta_p[i] - older) + older;
+        } else if (relaxation != 1) {
+            particles.x_star[i] += omega * particles.delta_p[i];
+        } else {
+            particles.x_star[i] += particles.delta_p[i];
+        }
+        if (chebyshev) {
+            previousXStar[i] = x;
+        }
+
+        for (const CollisionPlane &cp_i : planes) {
+            // Collision detection and response
+            particles.x_star[i] = cp_i.handleCollision(particles.x_i[i], particles.x_star[i]);
+        }
     }
+    return correction;
+}
 
-    return vorticity;
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::updateVelocities(int begin, int end, double delta) {
+    for (int i = begin; i < end; i++) {
+        particles.v_i[i] = (particles.x_star[i] - particles.x_i[i]) / (Scalar)delta;
+        if (symmetricStep) {
+            particles.vorticity_W[i] = Vector3::Zero();
+            pairGradW[i] = Vector3::Zero();
+            xsphDelta[i] = Vector3::Zero();
+        }
+    }
 }
 
-V3D ParticleSystem::getVorticityN(int i) {
-    V3D grad_w = getGradW(i);
-    return grad_w / (grad_w.length() + pow(10, -20));
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::sumVorticityW(int begin, int end, int part) {
+    vorticityScatter.beginPart(part);
+    forEachPair(begin, end, [&](int i, int j, const PairKernels &kernels) {
+        Vector3 rel_vel = particles.v_i[j] - particles.v_i[i];
+        Vector3 term = rel_vel.cross(-kernels.gradW);
+        particles.vorticity_W[i] += term;
+        vorticityScatter.at(part, j) += term;
+    });
 }
 
-V3D ParticleSystem::getGradW(int i) {
-    V3D grad_w = V3D();
-    for (int j : particles[i].neighbors) {
-        double diff_w = particles[j].vorticity_W.length() - particles[i].vorticity_W.length();
-        V3D j_to_i = particles[i].x_star - particles[j].x_star;
-        double diff_p = j_to_i.length() + pow(10, -20);
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::sumVorticityGradient(int begin, int end, int part) {
+    gradWScatter.beginPart(part);
+    forEachPair(begin, end, [&](int i, int j, const PairKernels &kernels) {
+        Scalar diff_w = particles.vorticity_W[j].norm() - particles.vorticity_W[i].norm();
+        Scalar diff_p = kernels.distance + (Scalar)1e-20;
+        Vector3 term = -kernels.gradW * (diff_w / diff_p);
+        pairGradW[i] += term;
+        gradWScatter.at(part, j) += term;
+    });
+}
+
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::sumXSPH(int begin, int end, int part) {
+    xsphScatter.beginPart(part);
+    forEachPair(begin, end, [&](int i, int j, const PairKernels &kernels) {
+        Vector3 term = (particles.v_i[j] - particles.v_i[i]) * kernels.w;
+        xsphDelta[i] += term;
+        xsphScatter.at(part, j) -= term;
+    });
+}
 
-        grad_w += spiky(j_to_i, KERNEL_H, false) * (diff_w / diff_p);
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::applyVorticityAndViscosity(int begin, int end, double delta) {
+    if (symmetricStep) {
+        gradWScatter.reduceRange(begin, end);
+        xsphScatter.reduceRange(begin, end);
+        for (int i = begin; i < end; i++) {
+            particles.vorticity_N[i] = pairGradW[i] / (pairGradW[i].norm() + (Scalar)1e-20);
+            xsphDelta[i] *= (Scalar)activeParams.viscosityC;
+        }
     }
 
-    return grad_w;
-}
+    for (int i = begin; i < end; i++) {
+        // Apply vorticity
+        Vector3 vorticity_F = (particles.vorticity_N[i].cross(particles.vorticity_W[i])) * (Scalar)activeParams.vorticityEpsilon;
+        particles.v_i[i] += vorticity_F * (Scalar)delta;
 
-V3D ParticleSystem::getXSPH(int i) {
-    V3D delta_v = V3D();
+        // Apply viscosity
+        particles.v_i[i] += xsphDelta[i];
 
-    for (int j : particles[i].neighbors) {
-        V3D rel_vel = particles[j].v_i - particles[i].v_i;
-        V3D j_to_i = particles[i].x_star - particles[j].x_star;
-        delta_v += rel_vel * poly6(j_to_i, KERNEL_H);
+        particles.x_i[i] = particles.x_star[i];
     }
+}
 
-    return delta_v * VISCOSITY_C;
+// Copies the final positions of the step into the array drawn by drawParticleSystem.
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::fillDrawBuffer(int begin, int end) {
+    for (int i = begin; i < end; i++) {
+        const Vector3 &x = particles.x_star[i];
+        positionArray[3 * i] = x[0];
+        positionArray[3 * i + 1] = x[1];
+        positionArray[3 * i + 2] = x[2];
+    }
 }
 
 // Code for drawing the particle system is below here.
@@ -370,22 +1315,22 @@ GLuint makeBoxDisplayList() {
     return index;
 }
 
-void ParticleSystem::drawParticleSystem() {
+template<typename Scalar, typename Kernels>
+void ParticleSystemT<Scalar, Kernels>::drawParticleSystem() {
 
     int numParticles = particles.size();
-    int i = 0;
 
     glCallList(boxList);
 
-    // Copy particle positions into array
-    positionArray.clear();
-    pointsIndexArray.clear();
-    for (auto &p : particles) {
-        positionArray.push_back(p.x_i[0]);
-        positionArray.push_back(p.x_i[1]);
-        positionArray.push_back(p.x_i[2]);
-        pointsIndexArray.push_back(i);
-        i++;
+    // The step leaves the positions in the array, unless particles were moved since
+    if (!drawBufferFilled) {
+        for (int i = 0; i < numParticles; i++) {
+            const Vector3 &x = particles.x_i[i];
+            positionArray[3 * i] = x[0];
+            positionArray[3 * i + 1] = x[1];
+            positionArray[3 * i + 2] = x[2];
+        }
+        drawBufferFilled = true;
     }
 
     if (drawParticles && numParticles > 0) {
@@ -400,4 +1345,11 @@ void ParticleSystem::drawParticleSystem() {
         glDisableClientState(GL_VERTEX_ARRAY);
     }
 
-}
\ No newline at end of file
+}
+
+template class ParticleSystemT<float, Poly6SpikyKernels>;
+template class ParticleSystemT<float, CubicSplineKernels>;
+template class ParticleSystemT<float, WendlandC2Kernels>;
+template class ParticleSystemT<double, Poly6SpikyKernels>;
+template class ParticleSystemT<double, CubicSplineKernels>;
+template class ParticleSystemT<double, WendlandC2Kernels>;
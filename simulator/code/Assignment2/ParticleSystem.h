@@ -4,8 +4,19 @@
 #include <list>
 #include "GUILib/GLMesh.h"
 #include "CollisionPlane.h"
-#include "Particle.h"
+#include "ParticleStore.h"
 #include "SpatialMap.h"
+#include "UniformGrid.h"
+#include "SpatialHash.h"
+#include "NeighborList.h"
+#include "SimulationStats.h"
+#include "SimulationParams.h"
+#include "SPHKernels.h"
+#include "KernelBatch.h"
+#include "ScatterBuffer.h"
+#include "Utils/ThreadPool.h"
+#include "Utils/TaskGraph.h"
+#include "Constants.h"
 
 using namespace std;
 
@@ -17,15 +28,112 @@ struct ParticleInit {
 
 using namespace Eigen;
 
-class ParticleSystem {
+// How the solver applies the position corrections of an iteration.
+enum SolverAcceleration {
+    // The plain Jacobi corrections
+    JACOBI_SOLVER,
+    // The corrections scaled by ParticleSystemSettings::sorFactor
+    SOR_SOLVER,
+    // Chebyshev semi-iterative acceleration, with the spectral radius of the iteration
+    // estimated anew every step
+    CHEBYSHEV_SOLVER,
+    // Gauss-Seidel: the particles are colored so that those of a color can be corrected
+    // concurrently, and each color moves with the corrections of the ones before it
+    GAUSS_SEIDEL_SOLVER,
+    SOLVER_ACCELERATION_COUNT
+};
+
+const char* solverAccelerationName(SolverAcceleration acceleration);
+
+// Settings shared by the particle systems of every precision.
+class ParticleSystemSettings {
+public:
+    // Physical parameters and the fixed time step. Systems pick up changes at their next step.
+    static SimulationParams params;
+    // Whether or not we should draw springs and particles as lines and dots respectively.
+    static bool drawParticles;
+    static bool enableGravity;
+    // Build neighbor lists by testing every pair of particles instead of using the spatial map.
+    // This is O(N^2) and only meant as a reference to validate the fast path against.
+    static bool bruteForceNeighbors;
+    // Acceleration structure used for the neighbor search when not in brute-force mode.
+    static NeighborBackend neighborBackend;
+    // Number of steps between Morton reorderings of the particles (0 disables reordering).
+    static int reorderInterval;
+    // Extra search radius that lets neighbor lists be reused over several steps.
+    static double neighborSkin;
+    // Visit every pair of neighbors once and scatter the result to both particles,
+    // instead of evaluating each pair from both sides.
+    static bool symmetricPairs;
+    // Above this fraction of particles changing cells, the spatial map is rebuilt instead of
+    // updated in place (0 always rebuilds). The other backends re-sort whenever any particle
+    // changed cells.
+    static double maxCellChurn;
+    // Instruction set used to evaluate the kernels, capped at what the host supports.
+    // SIMD_SCALAR evaluates them one neighbor at a time, as a reference for the vector paths.
+    static SimdLevel kernelSimd;
+    // Evaluate the kernels of every pair once per solver iteration, and once for the velocity
+    // update, instead of once in every pass that needs them.
+    static bool cachePairs;
+    // Threads the step runs on, including the one calling integrate_PBF.
+    static int threadCount;
+    // Write the solver iterations of every step, and the density error before each, to log.txt.
+    static bool logIterations;
+    // Acceleration of the solver iterations, and the over-relaxation factor of SOR_SOLVER.
+    static SolverAcceleration solverAcceleration;
+    static double sorFactor;
+    // Solve the density constraint as in XPBD, with accumulated lambdas and params.compliance,
+    // instead of softening it by params.cfmEpsilon.
+    static bool xpbdConstraint;
+    // Skin of the neighbor lists when a step is split into params.substeps substeps. The lists
+    // are checked at every substep, and rebuilt when some particle moved more than half the
+    // margin, which at the default parameters happens at most substeps.
+    static double substepMargin;
+    // Start every substep by applying the multipliers the previous one ended with (its last
+    // lambdas, or the accumulated ones under XPBD) scaled by params.warmStartDamping, before the
+    // first iteration.
+    static bool warmStart;
+};
+
+/**
+ * Position based fluid simulated in the precision given by Scalar, with the kernel family given
+ * by the Kernels policy (see SPHKernels.h). Kernels and per-particle state use Scalar, while
+ * densities and the gradient sums of the constraint, where the solver subtracts nearly equal
+ * quantities, are accumulated in double.
+ * Every combination of float or double with the policies in SPHKernels.h is compiled;
+ * ParticleSystem is the one the application runs (see PBF_SCALAR and PBF_KERNELS in Constants.h).
+ */
+template<typename Scalar, typename Kernels = Poly6SpikyKernels>
+class ParticleSystemT : public ParticleSystemSettings {
+public:
+    typedef Eigen::Matrix<Scalar, 3, 1> Vector3;
+    typedef typename Kernels::template Density<Scalar> DensityKernel;
+    typedef typename Kernels::template Gradient<Scalar> GradientKernel;
+
 private:
-    vector<Particle> particles;
+    // Workers for the passes of the step. Up to the neighbor search, each pass splits the
+    // particles into one range per thread; the rest of the step runs as task graphs: the warm
+    // start, the two halves of a solver iteration, and the velocity update.
+    ThreadPool pool;
+    TaskGraph warmStartGraph;
+    TaskGraph densityGraph;
+    TaskGraph correctionGraph;
+    TaskGraph velocityGraph;
+    ParticleStore<Scalar> particles;
     vector<CollisionPlane> planes;
     SpatialMap particleMap;
+    UniformGrid particleGrid;
+    SpatialHash particleHash;
+    NeighborList neighbors;
+    // Predicted positions converted to double for the neighbor search structures
+    PositionArray searchPositions;
 
     // Vectors to pass to OpenGL for drawing.
     // Each time step, the relevant data are copied into these lists.
     vector<double> positionArray;
+    // Whether positionArray holds the current positions. The step fills it once the positions
+    // are final, alongside the velocity update.
+    bool drawBufferFilled;
     vector<unsigned int> pointsIndexArray;
     vector<unsigned int> edgesIndexArray;
     vector<double> zlSpringPositionArray;
@@ -33,36 +141,252 @@ private:
 
     unsigned int boxList;
 
-    double getLambda(int i);
+    SimulationStats stats;
+    int stepCount;
+    // newIndexOf[i] is the index that particle i moved to in the last reorder
+    vector<int> newIndexOf;
+    bool reorderedLastStep;
+
+    void reorderParticles();
+    double computeMeanNeighborSpan();
+    // Neighbor lists are built with radius kernelH + searchSkin and reused until some
+    // particle has moved more than half the skin away from where it was at the build.
+    // searchSkin is neighborSkin, or substepMargin when the step is split into substeps.
+    double searchSkin;
+    AlignedVector<Vector3> neighborBuildPositions;
+    double neighborBuildRadius;
+    int neighborBuildMode;
+    bool neighborBuildSymmetric;
+
+    NeighborSearch* getNeighborSearch();
+    bool neighborListsExpired();
+    // Rebuilds the neighbor lists if they expired, once per step
+    void updateNeighbors();
+    void rebuildNeighbors();
+    void findNeighbors(double radius);
+    void findNeighborsBruteForce(int i, double radius, bool half, vector<int> &out);
+
+    // Kernels of one pair of neighbors i and j, at r_ij = x*_i - x*_j
+    struct PairKernels {
+        // Density kernel W(r_ij)
+        Scalar w;
+        // Gradient of the gradient kernel W(r_ij) with respect to x*_i
+        Vector3 gradW;
+        // |r_ij|
+        Scalar distance;
+    };
+
+    // Kernel batch and counters of one thread
+    struct ThreadScratch {
+        long long kernelEvaluations;
+        KernelBatch<Scalar> kernelBatch;
+    };
+    vector<ThreadScratch> threadScratch;
+    KernelBatchCoefficients<Scalar> kernelCoefficients;
+
+    // Kernels of the pairs in the neighbor lists that are within kernelH, laid out like the
+    // lists: the cached neighbors of i are pairNeighbors[neighbors.offsets[i]] ...
+    // pairNeighbors[pairEnds[i] - 1], and their kernels the matching entries of pairKernels.
+    // Filled once per solver iteration, while the predicted positions stay put, and read by
+    // every pass in between.
+    AlignedVector<PairKernels> pairKernels;
+    vector<int> pairNeighbors;
+    vector<int> pairEnds;
+    bool pairKernelsCached;
+
+    // Evaluates the kernels of particle i with every neighbor in its list, up to
+    // KERNEL_BATCH_SIZE neighbors at a time in SIMD lanes, and calls f(p, kernels) where p is
+    // the position of the neighbor in neighbors.indices.
+    template<typename F>
+    void evaluateNeighborKernels(int i, F f) {
+        ThreadScratch &scratch = threadScratch[ThreadPool::currentThread()];
+        KernelBatch<Scalar> &kernelBatch = scratch.kernelBatch;
+        const Vector3 &x_i = particles.x_star[i];
+        int p = neighbors.offsets[i];
+        int end = neighbors.offsets[i + 1];
+        while (p != end) {
+            int count = min(end - p, KERNEL_BATCH_SIZE);
+            kernelBatch.count = count;
+            kernelBatch.padded = (count + KERNEL_BATCH_MAX_LANES - 1) / KERNEL_BATCH_MAX_LANES * KERNEL_BATCH_MAX_LANES;
+            for (int k = 0; k < count; k++) {
+                const Vector3 &x_j = particles.x_star[neighbors.indices[p + k]];
+                kernelBatch.rx[k] = x_i[0] - x_j[0];
+                kernelBatch.ry[k] = x_i[1] - x_j[1];
+                kernelBatch.rz[k] = x_i[2] - x_j[2];
+            }
+            for (int k = count; k < kernelBatch.padded; k++) {
+                kernelBatch.rx[k] = kernelBatch.ry[k] = kernelBatch.rz[k] = 0;
+            }
+
+            evaluateKernelBatch(kernelSimd, kernelCoefficients, kernelBatch);
+            scratch.kernelEvaluations += count;
+
+            PairKernels kernels;
+            for (int k = 0; k < count; k++) {
+                kernels.w = kernelBatch.w[k];
+                kernels.gradW = Vector3(kernelBatch.gx[k], kernelBatch.gy[k], kernelBatch.gz[k]);
+                kernels.distance = kernelBatch.dist[k];
+                f(p + k, kernels);
+            }
+            p += count;
+        }
+    }
+
+    // Calls f(j, kernels) for every neighbor j of particle i.
+    // All solver passes go through here so that they only ever touch neighbors. The kernels
+    // come from pairKernels when they are cached, and are evaluated on the spot otherwise.
+    // The lists include a skin, so pairs that are currently outside the kernel are skipped;
+    // every density kernel is positive everywhere inside kernelH.
+    template<typename F>
+    void forEachNeighbor(int i, F f) {
+        if (pairKernelsCached) {
+            for (int p = neighbors.offsets[i]; p < pairEnds[i]; p++) {
+                f(pairNeighbors[p], pairKernels[p]);
+            }
+            return;
+        }
+
+        evaluateNeighborKernels(i, [&](int p, const PairKernels &kernels) {
+            if (kernels.w > 0) {
+                f(neighbors.indices[p], kernels);
+            }
+        });
+    }
+
+    // Calls f(i, j, kernels) once for every unordered pair of particles closer than kernelH
+    // with i in [begin, end). Only valid when the neighbor lists were built with symmetricStep
+    // on. Contributions to j have to go through a ScatterBuffer.
+    template<typename F>
+    void forEachPair(int begin, int end, F f) {
+        for (int i = begin; i < end; i++) {
+            forEachNeighbor(i, [&](int j, const PairKernels &kernels) {
+                f(i, j, kernels);
+            });
+        }
+    }
+
+    // Calls f(i) for every particle, spread over the threads.
+    template<typename F>
+    void forEachParticle(F f) {
+        pool.parallelFor(particles.size(), f);
+    }
+
+    // Per-particle sums accumulated by the symmetric passes, with one part per thread
+    vector<Vector3d> pairGradSelf;
+    vector<double> pairGradSq;
+    vector<Vector3> pairGradW;
+    vector<Vector3> xsphDelta;
+    ScatterBuffer<double> densityScatter;
+    ScatterBuffer<Vector3d> gradSelfScatter;
+    ScatterBuffer<double> gradSqScatter;
+    ScatterBuffer<Vector3> deltaPScatter;
+    ScatterBuffer<Vector3> vorticityScatter;
+    ScatterBuffer<Vector3> gradWScatter;
+    ScatterBuffer<Vector3> xsphScatter;
+
+    // Per-part sums of the density error of the current iteration, and of the squared
+    // corrections it applied
+    vector<double> densityErrorParts;
+    vector<double> correctionParts;
+    // Per-part largest squared speed after the velocity update
+    vector<double> speedParts;
+    // The compliance divided by the square of the substep, for XPBD.
+    double complianceScale;
+    // The constraint (xpbdConstraint) the multipliers in particles.lambda_i and lambda_sum were
+    // last solved with, or -1 before the first solve, and whether the warm start is running.
+    int lambdaConstraint;
+    bool warmStarting;
+    // Factor the corrections of the current iteration are applied with, and for Chebyshev
+    // acceleration the predicted positions before the previous iteration.
+    double relaxation;
+    vector<Vector3> previousXStar;
+    double nextRelaxation(int iteration);
+
+    // symmetricPairs for the current step. Gauss-Seidel needs every neighbor of a particle in its
+    // own list.
+    bool symmetricStep;
+    // Particles sorted by Gauss-Seidel color and cell (see buildColors), the start of each cell
+    // in colorOrder, and the first cell of each color. Valid until the neighbor lists are rebuilt.
+    vector<int> colorOrder;
+    vector<int> colorCellStarts;
+    vector<int> colorFirstCell;
+    bool colorsBuilt;
+    void buildColors();
+    void buildGaussSeidelSweep();
+    void solveGaussSeidel(int i);
+
+    void buildSolverGraphs();
+    int addCorrectionTasks(TaskGraph &graph, int lambdas, int cache);
+    bool solveConstraints(int iterations, const string &prefix);
+    void buildVelocityGraph(double delta, bool cacheKernels, bool draw);
+    void runGraph(TaskGraph &graph, const string &suffix);
+    void logSolverIterations();
+
+    // Bodies of the tasks, each over the particles in [begin, end). The symmetric sums are
+    // partitioned, and add to the particles of other parts through the scatter buffers;
+    // the tasks after them reduce those for their own range first.
+    void cachePairKernels(int begin, int end);
+    void warmStartLambdas(int begin, int end);
+    void clearSolverSums(int begin, int end);
+    void sumLambdaTerms(int begin, int end, int part);
+    void computeLambdas(int begin, int end);
+    double sumDensityError(int begin, int end);
+    void sumDeltaP(int begin, int end, int part);
+    double applyDeltaP(int begin, int end);
+    void updateVelocities(int begin, int end, double delta);
+    void sumVorticityW(int begin, int end, int part);
+    void sumVorticityGradient(int begin, int end, int part);
+    void sumXSPH(int begin, int end, int part);
+    void applyVorticityAndViscosity(int begin, int end, double delta);
+    void fillDrawBuffer(int begin, int end);
+
+    Scalar getLambda(int i);
+    Scalar solveLambda(int i, double c, double gradSum);
     double getC(int i);
     double getDensity(int i);
-    V3D getGradC(int i, int k);
-    V3D getDeltaP(int i);
-    double getCorr(int i, int j);
+    Vector3 getDeltaP(int i);
+    Scalar getCorr(Scalar w);
 
-    double poly6(V3D r, double h);
-    V3D spiky(V3D r, double h, bool wrt_first);
+    // The params the current step runs with, and the kernels with support kernelH and
+    // 1 / W(tensileDeltaQ * kernelH) for the tensile correction, computed from them
+    SimulationParams activeParams;
+    void applyParams();
+    DensityKernel densityKernel;
+    GradientKernel gradientKernel;
+    Scalar corrNormalization;
 
-    V3D getVorticityW(int i);
-    V3D getVorticityN(int i);
-    V3D getGradW(int i);
-    V3D getXSPH(int i);
+    Vector3 getVorticityW(int i);
+    Vector3 getVorticityN(int i);
+    Vector3 getGradW(int i);
+    Vector3 getXSPH(int i);
 
 public:
-    ParticleSystem(vector<ParticleInit>& particles);
-    ~ParticleSystem();
+    ParticleSystemT(vector<ParticleInit>& particles);
+    ~ParticleSystemT();
     P3D getPositionOf(int i);
     int particleCount();
 
     void applyForces(double delta);
     void integrate_PBF(double delta);
+    const SimulationStats& getStats() { return stats; }
+    // Mean |C_i| over all particles at their current positions, from the densities over every
+    // pair rather than the neighbor lists. O(N^2), for benchmarks.
+    double measureDensityError();
+
+    // Particles are periodically permuted to keep neighbors close in memory. Anything holding
+    // on to a particle index must pass it through getNewIndex() whenever wasReordered() is true
+    // after a call to integrate_PBF.
+    bool wasReordered() { return reorderedLastStep; }
+    int getNewIndex(int oldIndex) { return newIndexOf[oldIndex]; }
 
     // Functions for display and interactivity
     void drawParticleSystem();
     void setPosition(int i, P3D x);
     void setVelocity(int i, V3D v);
+};
 
-    // Whether or not we should draw springs and particles as lines and dots respectively.
-    static bool drawParticles;
-    static bool enableGravity;
-};
\ No newline at end of file
+// The particle system in the precision and with the kernels the application is built with.
+class ParticleSystem : public ParticleSystemT<PBF_SCALAR, PBF_KERNELS> {
+public:
+    ParticleSystem(vector<ParticleInit>& particles) : ParticleSystemT<PBF_SCALAR, PBF_KERNELS>(particles) {}
+};
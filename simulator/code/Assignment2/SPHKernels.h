@@ -0,0 +1,283 @@
+#pragma once
+
+#include "MathLib/MathLib.h"
+#include "MathLib/V3D.h"
+#include "KernelBatch.h"
+#include <cmath>
+
+// Value and gradient of a kernel at one offset r, with the distance |r| they were computed from.
+template<typename Scalar>
+struct KernelSample {
+	Scalar distance;
+	Scalar value;
+	Eigen::Matrix<Scalar, 3, 1> gradient;
+};
+
+/**
+ * Poly6 kernel W(r) = 315 / (64 pi h^9) (h^2 - |r|^2)^3 for |r| < h, and 0 beyond.
+ * The coefficient is computed once for the support radius h given at construction, and the
+ * kernel only depends on |r|^2, so evaluating it never takes a square root.
+ */
+template<typename Scalar>
+class Poly6Kernel {
+public:
+	typedef Eigen::Matrix<Scalar, 3, 1> Vector3;
+
+	explicit Poly6Kernel(double h)
+		: h2((Scalar)(h * h)), coeff((Scalar)(315.0 / 64.0 / PI / pow(h, 9))), gradCoeff((Scalar)(-6 * 315.0 / 64.0 / PI / pow(h, 9))) {}
+
+	// W at squared distance r2
+	Scalar value(Scalar r2) const {
+		if (r2 >= h2) return 0;
+		Scalar d = h2 - r2;
+		return coeff * d * d * d;
+	}
+
+	Scalar operator()(const Vector3 &r) const { return value(r.squaredNorm()); }
+
+	// Gradient of W(x_i - x_j) with respect to x_i, where r = x_i - x_j
+	Vector3 gradient(const Vector3 &r) const {
+		Scalar r2 = r.squaredNorm();
+		if (r2 >= h2) return Vector3::Zero();
+		Scalar d = h2 - r2;
+		return r * (gradCoeff * d * d);
+	}
+
+	KernelSample<Scalar> sample(const Vector3 &r) const {
+		Scalar r2 = r.squaredNorm();
+		KernelSample<Scalar> s;
+		s.distance = std::sqrt(r2);
+		if (r2 >= h2) {
+			s.value = 0;
+			s.gradient = Vector3::Zero();
+		} else {
+			Scalar d = h2 - r2;
+			s.value = coeff * d * d * d;
+			s.gradient = r * (gradCoeff * d * d);
+		}
+		return s;
+	}
+
+	Scalar supportRadius2() const { return h2; }
+	Scalar coefficient() const { return coeff; }
+
+private:
+	Scalar h2;
+	Scalar coeff;
+	Scalar gradCoeff;
+};
+
+/**
+ * Spiky kernel W(r) = 15 / (pi h^6) (h - |r|)^3 for |r| < h, and 0 beyond. Its gradient does
+ * not vanish as r goes to 0, which is why PBF uses it for the pressure terms. The gradient is
+ * taken to be 0 at r = 0, where the direction of r is undefined.
+ */
+template<typename Scalar>
+class SpikyKernel {
+public:
+	typedef Eigen::Matrix<Scalar, 3, 1> Vector3;
+
+	explicit SpikyKernel(double h)
+		: h((Scalar)h), h2((Scalar)(h * h)), coeff((Scalar)(15.0 / PI / pow(h, 6))), gradCoeff((Scalar)(-45.0 / PI / pow(h, 6))) {}
+
+	// W at distance r
+	Scalar value(Scalar r) const {
+		if (r >= h) return 0;
+		Scalar d = h - r;
+		return coeff * d * d * d;
+	}
+
+	Scalar operator()(const Vector3 &r) const {
+		Scalar r2 = r.squaredNorm();
+		return r2 >= h2 ? 0 : value(std::sqrt(r2));
+	}
+
+	// Gradient of W(x_i - x_j) with respect to x_i, where r = x_i - x_j
+	Vector3 gradient(const Vector3 &r) const {
+		Scalar r2 = r.squaredNorm();
+		if (r2 >= h2 || r2 == 0) return Vector3::Zero();
+		Scalar len = std::sqrt(r2);
+		Scalar d = h - len;
+		return r * (gradCoeff * d * d / len);
+	}
+
+	// Value and gradient from a single square root
+	KernelSample<Scalar> sample(const Vector3 &r) const {
+		Scalar r2 = r.squaredNorm();
+		KernelSample<Scalar> s;
+		s.distance = std::sqrt(r2);
+		if (r2 >= h2) {
+			s.value = 0;
+			s.gradient = Vector3::Zero();
+		} else {
+			Scalar d = h - s.distance;
+			s.value = coeff * d * d * d;
+			s.gradient = r2 == 0 ? Vector3::Zero() : Vector3(r * (gradCoeff * d * d / s.distance));
+		}
+		return s;
+	}
+
+	Scalar supportRadius2() const { return h2; }
+	Scalar gradientCoefficient() const { return gradCoeff; }
+
+private:
+	Scalar h;
+	Scalar h2;
+	Scalar coeff;
+	Scalar gradCoeff;
+};
+
+/**
+ * Cubic B-spline kernel with support h, in terms of q = |r| / h:
+ * W(r) = 8 / (pi h^3) (6 (q^3 - q^2) + 1) for q <= 1/2, 8 / (pi h^3) 2 (1 - q)^3 for q < 1, and 0
+ * beyond. The standard SPH kernel; like poly6 its gradient vanishes at r = 0.
+ */
+template<typename Scalar>
+class CubicSplineKernel {
+public:
+	typedef Eigen::Matrix<Scalar, 3, 1> Vector3;
+
+	explicit CubicSplineKernel(double h)
+		: h2((Scalar)(h * h)), invH((Scalar)(1 / h)), coeff((Scalar)(8.0 / PI / pow(h, 3))), gradCoeff((Scalar)(48.0 / PI / pow(h, 5))) {}
+
+	// W at distance r
+	Scalar value(Scalar r) const {
+		Scalar q = r * invH;
+		if (q >= 1) return 0;
+		Scalar e = 1 - q;
+		return coeff * (0.5 < q ? 2 * e * e * e : 6 * (q * q * q - q * q) + 1);
+	}
+
+	Scalar operator()(const Vector3 &r) const {
+		Scalar r2 = r.squaredNorm();
+		return r2 >= h2 ? 0 : value(std::sqrt(r2));
+	}
+
+	// Gradient of W(x_i - x_j) with respect to x_i, where r = x_i - x_j
+	Vector3 gradient(const Vector3 &r) const {
+		return sample(r).gradient;
+	}
+
+	KernelSample<Scalar> sample(const Vector3 &r) const {
+		Scalar r2 = r.squaredNorm();
+		KernelSample<Scalar> s;
+		s.distance = std::sqrt(r2);
+		if (r2 >= h2) {
+			s.value = 0;
+			s.gradient = Vector3::Zero();
+		} else {
+			Scalar q = s.distance * invH;
+			Scalar e = 1 - q;
+			s.value = coeff * (0.5 < q ? 2 * e * e * e : 6 * (q * q * q - q * q) + 1);
+			s.gradient = r * (gradCoeff * (0.5 < q ? (q - 1) * e / q : 3 * q - 2));
+		}
+		return s;
+	}
+
+	Scalar supportRadius2() const { return h2; }
+	Scalar coefficient() const { return coeff; }
+	Scalar gradientCoefficient() const { return gradCoeff; }
+
+private:
+	Scalar h2;
+	Scalar invH;
+	Scalar coeff;
+	Scalar gradCoeff;
+};
+
+/**
+ * Wendland C2 kernel W(r) = 21 / (2 pi h^3) (1 - q)^4 (1 + 4 q) for q = |r| / h < 1, and 0
+ * beyond. Its Fourier transform is positive, so unlike the spline kernels it does not let
+ * particles pair up, and it stays stable with fewer neighbors.
+ */
+template<typename Scalar>
+class WendlandC2Kernel {
+public:
+	typedef Eigen::Matrix<Scalar, 3, 1> Vector3;
+
+	explicit WendlandC2Kernel(double h)
+		: h2((Scalar)(h * h)), invH((Scalar)(1 / h)), coeff((Scalar)(21.0 / 2.0 / PI / pow(h, 3))), gradCoeff((Scalar)(-210.0 / PI / pow(h, 5))) {}
+
+	// W at distance r
+	Scalar value(Scalar r) const {
+		Scalar q = r * invH;
+		if (q >= 1) return 0;
+		Scalar e = 1 - q;
+		return coeff * e * e * e * e * (1 + 4 * q);
+	}
+
+	Scalar operator()(const Vector3 &r) const {
+		Scalar r2 = r.squaredNorm();
+		return r2 >= h2 ? 0 : value(std::sqrt(r2));
+	}
+
+	// Gradient of W(x_i - x_j) with respect to x_i, where r = x_i - x_j. Well defined at r = 0,
+	// where it is 0, so no special case is needed.
+	Vector3 gradient(const Vector3 &r) const {
+		Scalar r2 = r.squaredNorm();
+		if (r2 >= h2) return Vector3::Zero();
+		Scalar e = 1 - std::sqrt(r2) * invH;
+		return r * (gradCoeff * e * e * e);
+	}
+
+	KernelSample<Scalar> sample(const Vector3 &r) const {
+		Scalar r2 = r.squaredNorm();
+		KernelSample<Scalar> s;
+		s.distance = std::sqrt(r2);
+		if (r2 >= h2) {
+			s.value = 0;
+			s.gradient = Vector3::Zero();
+		} else {
+			Scalar q = s.distance * invH;
+			Scalar e = 1 - q;
+			s.value = coeff * e * e * e * e * (1 + 4 * q);
+			s.gradient = r * (gradCoeff * e * e * e);
+		}
+		return s;
+	}
+
+	Scalar supportRadius2() const { return h2; }
+	Scalar coefficient() const { return coeff; }
+	Scalar gradientCoefficient() const { return gradCoeff; }
+
+private:
+	Scalar h2;
+	Scalar invH;
+	Scalar coeff;
+	Scalar gradCoeff;
+};
+
+// Kernel policies for the solver. Each names a family, the kernel used for densities (and the
+// tensile correction and viscosity) and the one whose gradient drives the constraint.
+struct Poly6SpikyKernels {
+	static const KernelFamily family = POLY6_SPIKY_KERNELS;
+	template<typename Scalar> using Density = Poly6Kernel<Scalar>;
+	template<typename Scalar> using Gradient = SpikyKernel<Scalar>;
+};
+
+struct CubicSplineKernels {
+	static const KernelFamily family = CUBIC_SPLINE_KERNELS;
+	template<typename Scalar> using Density = CubicSplineKernel<Scalar>;
+	template<typename Scalar> using Gradient = CubicSplineKernel<Scalar>;
+};
+
+struct WendlandC2Kernels {
+	static const KernelFamily family = WENDLAND_C2_KERNELS;
+	template<typename Scalar> using Density = WendlandC2Kernel<Scalar>;
+	template<typename Scalar> using Gradient = WendlandC2Kernel<Scalar>;
+};
+
+// The coefficients evaluateKernelBatch needs to evaluate the kernels of a policy with support h.
+template<typename Kernels, typename Scalar>
+KernelBatchCoefficients<Scalar> kernelBatchCoefficients(double h) {
+	typename Kernels::template Density<Scalar> density(h);
+	typename Kernels::template Gradient<Scalar> gradient(h);
+	KernelBatchCoefficients<Scalar> c;
+	c.family = Kernels::family;
+	c.h = (Scalar)h;
+	c.h2 = density.supportRadius2();
+	c.invH = (Scalar)(1 / h);
+	c.value = density.coefficient();
+	c.gradient = gradient.gradientCoefficient();
+	return c;
+}
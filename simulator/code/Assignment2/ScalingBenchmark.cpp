@@ -0,0 +1,68 @@
+#include "ScalingBenchmark.h"
+#include "ParticleSystemLoader.h"
+#include "Constants.h"
+#include "Utils/Logger.h"
+#include "Utils/ThreadPool.h"
+#include <algorithm>
+
+using namespace std;
+
+vector<int> scalingThreadCounts() {
+	int hardware = ThreadPool::hardwareThreads();
+	vector<int> counts;
+	for (int t = 1; t < hardware; t *= 2) {
+		counts.push_back(t);
+	}
+	counts.push_back(hardware);
+	return counts;
+}
+
+vector<ThreadScalingResult> benchmarkThreadScaling(const string &meshPath, const vector<int> &threadCounts, int steps) {
+	int savedThreads = ParticleSystem::threadCount;
+	bool savedGravity = ParticleSystem::enableGravity;
+	ParticleSystem::enableGravity = true;
+	steps = max(steps, 1);
+
+	vector<ThreadScalingResult> results;
+	for (int threads : threadCounts) {
+		ParticleSystem::threadCount = threads;
+		ParticleSystem *system = ParticleSystemLoader::loadFromOBJ(meshPath);
+		if (!system) break;
+
+		ThreadScalingResult result = {};
+		result.threads = threads;
+		for (int s = 0; s < steps; s++) {
+			system->integrate_PBF(ParticleSystem::params.deltaT);
+			const SimulationStats &stats = system->getStats();
+			result.stepTime += stats.stepTime / steps;
+			result.neighborSearchTime += stats.neighborSearchTime / steps;
+			result.solverTime += stats.solverTime / steps;
+			result.velocityUpdateTime += stats.velocityUpdateTime / steps;
+		}
+		delete system;
+
+		double baseTime = results.empty() ? result.stepTime : results[0].stepTime;
+		int baseThreads = results.empty() ? threads : results[0].threads;
+		result.speedup = result.stepTime > 0 ? baseTime / result.stepTime : 0;
+		result.efficiency = result.speedup * baseThreads / threads;
+		results.push_back(result);
+	}
+
+	ParticleSystem::threadCount = savedThreads;
+	ParticleSystem::enableGravity = savedGravity;
+	return results;
+}
+
+void runThreadScalingBenchmark(const string &meshPath, int steps) {
+	vector<ThreadScalingResult> results = benchmarkThreadScaling(meshPath, scalingThreadCounts(), steps);
+	if (results.empty()) {
+		Logger::consolePrint("Thread scaling benchmark: could not load %s\n", meshPath.c_str());
+		return;
+	}
+
+	Logger::consolePrint("Thread scaling benchmark: %s, %d steps, %d hardware threads\n", meshPath.c_str(), steps, ThreadPool::hardwareThreads());
+	for (const ThreadScalingResult &r : results) {
+		Logger::consolePrint("  %2d threads: step %7.2f ms (neighbors %6.2f, solver %6.2f, velocity %6.2f)  speedup %5.2fx  efficiency %5.1f%%\n",
+			r.threads, r.stepTime, r.neighborSearchTime, r.solverTime, r.velocityUpdateTime, r.speedup, 100 * r.efficiency);
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+// Average step timings (in milliseconds) of the solver on one number of threads.
+struct ThreadScalingResult {
+	int threads;
+	double stepTime;
+	double neighborSearchTime;
+	double solverTime;
+	double velocityUpdateTime;
+	// Step time on the first thread count benchmarked over the step time on this one, and that
+	// relative to the increase in threads
+	double speedup;
+	double efficiency;
+};
+
+// 1, 2, 4, ... threads up to the number of hardware threads, which is always included.
+std::vector<int> scalingThreadCounts();
+
+// Loads the particles of an OBJ mesh once per thread count and lets them fall for the given
+// number of steps, averaging the timings the solver reports. Every run starts from the same
+// state, so they all do the same work.
+std::vector<ThreadScalingResult> benchmarkThreadScaling(const std::string &meshPath, const std::vector<int> &threadCounts, int steps);
+
+// Runs the benchmark on the mesh for every count of scalingThreadCounts() and prints the
+// results to the console.
+void runThreadScalingBenchmark(const std::string &meshPath, int steps);
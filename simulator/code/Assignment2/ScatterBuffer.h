@@ -0,0 +1,85 @@
+#pragma once
+
+#include "Utils/ThreadPool.h"
+#include <vector>
+#include <algorithm>
+
+/**
+ * Lets the parts of a partitioned pass add to a per-particle array at once, for passes that
+ * visit each pair once and scatter the result to both particles. The particles are split into
+ * parts as ThreadPool::rangeBegin does, and part c adds to the particles of its own range
+ * directly; what it adds to any other particle goes to a private array of the part, which
+ * reduceRange() folds in afterwards in part order. Which thread runs a part does not matter,
+ * so the sums only depend on the number of parts, and with a single part they are the ones a
+ * serial loop gives. The private arrays are only reduced over the span of particles each part
+ * actually reached, which stays narrow once the particles are sorted spatially.
+ */
+template<typename T>
+class ScatterBuffer {
+public:
+	// Prepares for adding to values[0 ... n - 1] from the given number of parts. zero is the
+	// additive identity of T (Eigen vectors are not zero-initialized).
+	void begin(T *values, int n, int parts, const T &zero) {
+		this->values = values;
+		this->n = n;
+		this->parts = parts;
+		this->zero = zero;
+		if ((int)partial.size() != parts || (parts > 0 && (int)partial[0].size() != n)) {
+			partial.assign(parts, std::vector<T>(n, zero));
+		}
+		spans.resize(parts);
+		for (int c = 0; c < parts; c++) {
+			spans[c].ownBegin = ThreadPool::rangeBegin(c, n, parts);
+			spans[c].ownEnd = ThreadPool::rangeBegin(c + 1, n, parts);
+			beginPart(c);
+		}
+	}
+
+	// Starts another pass of part c over the same values. The previous pass has to be
+	// reduced already.
+	void beginPart(int c) {
+		spans[c].reachedBegin = n;
+		spans[c].reachedEnd = 0;
+	}
+
+	// Where part c adds its contributions to particle j.
+	T& at(int c, int j) {
+		PartSpan &span = spans[c];
+		if (j >= span.ownBegin && j < span.ownEnd) {
+			return values[j];
+		}
+		span.reachedBegin = std::min(span.reachedBegin, j);
+		span.reachedEnd = std::max(span.reachedEnd, j + 1);
+		return partial[c][j];
+	}
+
+	// Adds the private arrays to values[begin ... end - 1] and clears them there for the next
+	// pass. Once every part is done, disjoint ranges can be reduced concurrently.
+	void reduceRange(int begin, int end) {
+		for (int c = 0; c < parts; c++) {
+			std::vector<T> &p = partial[c];
+			for (int j = std::max(begin, spans[c].reachedBegin); j < std::min(end, spans[c].reachedEnd); j++) {
+				values[j] += p[j];
+				p[j] = zero;
+			}
+		}
+	}
+
+private:
+	// The particles part c owns, and the span of the others it added to. Padded to a cache
+	// line so that threads do not contend for each other's spans.
+	struct PartSpan {
+		int ownBegin;
+		int ownEnd;
+		int reachedBegin;
+		int reachedEnd;
+		char padding[48];
+	};
+
+	T *values;
+	int n;
+	int parts;
+	T zero;
+	std::vector<std::vector<T>> partial;
+	std::vector<PartSpan> spans;
+};
@@ -0,0 +1,95 @@
+#include "SimulationParams.h"
+#include "Utils/Logger.h"
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+bool SimulationParams::load(const string &path) {
+	ifstream file(path.c_str());
+	if (!file) {
+		Logger::consolePrint("Could not open parameter file %s\n", path.c_str());
+		return false;
+	}
+
+	SimulationParams loaded = *this;
+	struct { const char *name; double *value; } doubles[] = {
+		{ "deltaT", &loaded.deltaT },
+		{ "kernelH", &loaded.kernelH },
+		{ "restDensity", &loaded.restDensity },
+		{ "cfmEpsilon", &loaded.cfmEpsilon },
+		{ "tensileDeltaQ", &loaded.tensileDeltaQ },
+		{ "tensileK", &loaded.tensileK },
+		{ "viscosityC", &loaded.viscosityC },
+		{ "vorticityEpsilon", &loaded.vorticityEpsilon },
+		{ "solverTolerance", &loaded.solverTolerance },
+		{ "compliance", &loaded.compliance },
+		{ "warmStartDamping", &loaded.warmStartDamping },
+	};
+	struct { const char *name; int *value; } ints[] = {
+		{ "tensileN", &loaded.tensileN },
+		{ "minSolverIterations", &loaded.minSolverIterations },
+		{ "maxSolverIterations", &loaded.maxSolverIterations },
+		{ "substeps", &loaded.substeps },
+		{ "substepIterations", &loaded.substepIterations },
+	};
+
+	string line;
+	for (int lineNumber = 1; getline(file, line); lineNumber++) {
+		line = line.substr(0, line.find('#'));
+		istringstream fields(line);
+		string name;
+		if (!(fields >> name)) continue;
+
+		bool known = false;
+		bool valid = false;
+		for (auto &field : ints) {
+			if (name == field.name) {
+				known = true;
+				valid = (bool)(fields >> *field.value);
+			}
+		}
+		for (auto &field : doubles) {
+			if (name == field.name) {
+				known = true;
+				valid = (bool)(fields >> *field.value);
+			}
+		}
+		string rest;
+		if (!known || !valid || fields >> rest) {
+			Logger::consolePrint("%s:%d: expected a parameter name and its value\n", path.c_str(), lineNumber);
+			return false;
+		}
+	}
+
+	if (loaded.deltaT <= 0 || loaded.kernelH <= 0 || loaded.restDensity <= 0 || loaded.tensileN < 0) {
+		Logger::consolePrint("%s: deltaT, kernelH and restDensity have to be positive, and tensileN at least 0\n", path.c_str());
+		return false;
+	}
+	if (loaded.solverTolerance < 0 || loaded.minSolverIterations < 0 || loaded.maxSolverIterations < 1
+		|| loaded.compliance < 0 || loaded.substeps < 1 || loaded.substepIterations < 1) {
+		Logger::consolePrint("%s: maxSolverIterations, substeps and substepIterations have to be at least 1, and "
+			"solverTolerance, minSolverIterations and compliance at least 0\n", path.c_str());
+		return false;
+	}
+	if (loaded.warmStartDamping < 0 || loaded.warmStartDamping > 1) {
+		Logger::consolePrint("%s: warmStartDamping has to be between 0 and 1\n", path.c_str());
+		return false;
+	}
+	// The correction is normalized by W(deltaQ * kernelH), which is zero from the support radius on
+	if (loaded.tensileDeltaQ <= 0 || loaded.tensileDeltaQ >= 1) {
+		Logger::consolePrint("%s: tensileDeltaQ has to be between 0 and 1\n", path.c_str());
+		return false;
+	}
+	*this = loaded;
+	return true;
+}
+
+bool SimulationParams::operator==(const SimulationParams &other) const {
+	return deltaT == other.deltaT && kernelH == other.kernelH && restDensity == other.restDensity
+		&& cfmEpsilon == other.cfmEpsilon && tensileDeltaQ == other.tensileDeltaQ && tensileK == other.tensileK
+		&& tensileN == other.tensileN && viscosityC == other.viscosityC && vorticityEpsilon == other.vorticityEpsilon
+		&& solverTolerance == other.solverTolerance && minSolverIterations == other.minSolverIterations
+		&& maxSolverIterations == other.maxSolverIterations && compliance == other.compliance && substeps == other.substeps
+		&& substepIterations == other.substepIterations && warmStartDamping == other.warmStartDamping;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+
+/**
+ * Physical parameters of the fluid, the length of the fixed time step, and how much work the
+ * solver spends on each step. They can be edited in
+ * the menu, and loaded from a file of "name value" lines, where # starts a comment and the names
+ * are those of the fields below. A particle system takes a copy at the start of each step and
+ * only recomputes its kernels and other derived constants when that copy changes, so edits take
+ * effect from the next step on.
+ */
+struct SimulationParams {
+	// Length of a step when the time step is fixed
+	double deltaT = 0.008;
+	// Support radius of the kernels, which is also the cell size of the neighbor search
+	double kernelH = 0.25;
+	double restDensity = 30000000;
+	// Relaxation of the density constraint (epsilon in the PBF paper)
+	double cfmEpsilon = 0.1;
+	// Tensile correction -k (W(r) / W(deltaQ))^n, with deltaQ given as a fraction of kernelH,
+	// strictly between 0 and 1
+	double tensileDeltaQ = 0.2;
+	double tensileK = 0.2;
+	int tensileN = 4;
+	// XSPH viscosity and vorticity confinement
+	double viscosityC = 0.01;
+	double vorticityEpsilon = 0.0006;
+
+	// The solver stops once the mean density error is at most solverTolerance, after at least
+	// minSolverIterations and at most maxSolverIterations iterations (a tolerance of 0 never
+	// stops early)
+	double solverTolerance = 0;
+	int minSolverIterations = 2;
+	int maxSolverIterations = 10;
+	// Compliance of the XPBD density constraint, as soft as cfmEpsilon at deltaT by default
+	double compliance = cfmEpsilon * deltaT * deltaT;
+	// Substeps each step is split into, and the solver iterations of each when there are several
+	int substeps = 1;
+	int substepIterations = 1;
+	// Fraction of the previous substep's multipliers a warm start applies
+	double warmStartDamping = 0.8;
+
+	// Reads the parameters a file sets and keeps the others. Returns false, leaving every
+	// parameter as it was, if the file cannot be read or has a line it does not understand.
+	bool load(const std::string &path);
+
+	bool operator==(const SimulationParams &other) const;
+	bool operator!=(const SimulationParams &other) const { return !(*this == other); }
+};
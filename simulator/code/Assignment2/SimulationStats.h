@@ -0,0 +1,70 @@
+#pragma once
+
+#include "KernelBatch.h"
+#include "Utils/TaskGraph.h"
+#include <vector>
+
+// Timings (in milliseconds) and counters gathered during the last simulation step.
+struct SimulationStats {
+	double neighborSearchTime = 0;
+	double solverTime = 0;
+	double velocityUpdateTime = 0;
+	double stepTime = 0;
+	// Threads the step ran on, the substeps it was split into, and how often the neighbor lists
+	// had to be rebuilt after its first substep because particles moved past the margin
+	int threads = 1;
+	int substeps = 1;
+	int substepRebuilds = 0;
+	// Everything after the neighbor search runs as task graphs: how long they took, when each of
+	// their tasks ran (one after the other, in the order the graphs ran), and how long each
+	// thread was busy in them. The rest of the time the threads sat idle, waiting for
+	// dependencies.
+	double graphTime = 0;
+	std::vector<TaskTiming> tasks;
+	std::vector<double> threadBusyTimes;
+	// Solver iterations the step ran over all of its substeps, and the mean density error before
+	// each of them (plus the final one of a substep, when the solver stopped early)
+	int solverIterations = 0;
+	std::vector<double> densityErrors;
+	// RMS size of the corrections of each iteration, which shrinks as the iterations converge,
+	// and how long into the solver each iteration ended
+	std::vector<double> correctionSizes;
+	std::vector<double> iterationTimes;
+	// Spectral radius Chebyshev acceleration estimated for the step, and the relaxation factor
+	// of its last iteration
+	double spectralRadius = 0;
+	double relaxation = 1;
+	// Largest speed of any particle at the end of the step
+	double maxSpeed = 0;
+
+	// Total number of steps, and how many of them rebuilt the neighbor lists
+	int steps = 0;
+	int neighborRebuilds = 0;
+	int stepsSinceRebuild = 0;
+
+	// Particles that changed cells since the previous neighbor list rebuild, as a count and
+	// as a fraction of all particles, and how often the search structure was brought up to date
+	// without a rebuild (patched in place by SpatialMap, left as is by the other backends when no
+	// particle changed cells) rather than rebuilt.
+	int cellChanges = 0;
+	double cellChurn = 0;
+	int searchUpdates = 0;
+	int searchRebuilds = 0;
+
+	// Average |i - j| over all neighbor pairs (i, j). Neighbors that are close in memory
+	// share cache lines, so lower is better.
+	double meanNeighborSpan = 0;
+	// Number of times the particles have been reordered along the space-filling curve,
+	// and the mean neighbor span just before and after the most recent reorder.
+	int reorderCount = 0;
+	double spanBeforeReorder = 0;
+	double spanAfterReorder = 0;
+
+	// Kernel family the solver was compiled with, the instruction set the kernels were evaluated
+	// with, and how many neighbors it handles at once
+	KernelFamily kernelFamily = POLY6_SPIKY_KERNELS;
+	SimdLevel kernelSimd = SIMD_SCALAR;
+	int kernelLanes = 1;
+	// Pairs the kernels were evaluated for during the step, each pair counting once per evaluation
+	long long kernelEvaluations = 0;
+};
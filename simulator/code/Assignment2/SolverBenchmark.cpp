@@ -0,0 +1,153 @@
+#include "SolverBenchmark.h"
+#include "Constants.h"
+#include "Utils/Logger.h"
+#include <algorithm>
+
+using namespace std;
+
+vector<ParticleInit> damBreakParticles(double spacing) {
+	vector<ParticleInit> particles;
+	for (double y = spacing / 2; y < 1.6; y += spacing) {
+		for (double z = -1 + spacing / 2; z < -0.4; z += spacing) {
+			for (double x = -1 + spacing / 2; x < -0.4; x += spacing) {
+				ParticleInit particle;
+				particle.position = P3D(x, y, z);
+				particle.velocity = V3D(0, 0, 0);
+				particle.mass = 1;
+				particles.push_back(particle);
+			}
+		}
+	}
+	return particles;
+}
+
+vector<SolverConvergenceResult> benchmarkSolverConvergence(double spacing, int steps, int iterations) {
+	SolverAcceleration savedAcceleration = ParticleSystem::solverAcceleration;
+	SimulationParams savedParams = ParticleSystem::params;
+	bool savedGravity = ParticleSystem::enableGravity;
+	ParticleSystem::params.solverTolerance = 0;
+	ParticleSystem::params.maxSolverIterations = max(iterations, 1);
+	ParticleSystem::params.substeps = 1;
+	ParticleSystem::enableGravity = true;
+	steps = max(steps, 1);
+
+	vector<ParticleInit> initial = damBreakParticles(spacing);
+	vector<SolverConvergenceResult> results;
+	for (int a = 0; a < SOLVER_ACCELERATION_COUNT; a++) {
+		ParticleSystem::solverAcceleration = (SolverAcceleration)a;
+		ParticleSystem system(initial);
+
+		SolverConvergenceResult result = {};
+		result.acceleration = (SolverAcceleration)a;
+		result.correctionSizes.assign(ParticleSystem::params.maxSolverIterations, 0);
+		result.times.assign(ParticleSystem::params.maxSolverIterations, 0);
+		result.densityErrors.assign(ParticleSystem::params.maxSolverIterations, 0);
+		for (int s = 0; s < steps; s++) {
+			system.integrate_PBF(ParticleSystem::params.deltaT);
+			const SimulationStats &stats = system.getStats();
+			for (int k = 0; k < (int)stats.correctionSizes.size(); k++) {
+				result.correctionSizes[k] += stats.correctionSizes[k] / steps;
+				result.times[k] += stats.iterationTimes[k] / steps;
+				result.densityErrors[k] += stats.densityErrors[k] / steps;
+			}
+			result.solverTime += stats.solverTime / steps;
+			result.spectralRadius += stats.spectralRadius / steps;
+		}
+		results.push_back(result);
+	}
+
+	ParticleSystem::solverAcceleration = savedAcceleration;
+	ParticleSystem::params = savedParams;
+	ParticleSystem::enableGravity = savedGravity;
+	return results;
+}
+
+void runSolverBenchmark(double spacing, int steps) {
+	int iterations = ParticleSystem::params.maxSolverIterations;
+	vector<SolverConvergenceResult> results = benchmarkSolverConvergence(spacing, steps, iterations);
+
+	Logger::consolePrint("Solver benchmark: dam break with %d particles, %d steps, %d iterations\n",
+		(int)damBreakParticles(spacing).size(), steps, iterations);
+	for (const SolverConvergenceResult &r : results) {
+		Logger::consolePrint("  %-12s solver %7.2f ms/step, spectral radius %.3f\n",
+			solverAccelerationName(r.acceleration), r.solverTime, r.spectralRadius);
+		for (int k = 0; k < (int)r.correctionSizes.size(); k++) {
+			Logger::consolePrint("    iteration %2d: correction %.3e, done at %7.3f ms (density error before %.8f)\n",
+				k + 1, r.correctionSizes[k], r.times[k], r.densityErrors[k]);
+		}
+	}
+
+	// How soon each acceleration gets down to the corrections Jacobi ends with
+	double target = results[JACOBI_SOLVER].correctionSizes.back();
+	Logger::consolePrint("  Reaching the last correction of Jacobi (%.3e):\n", target);
+	for (const SolverConvergenceResult &r : results) {
+		int k = 0;
+		while (k < (int)r.correctionSizes.size() && r.correctionSizes[k] > target) k++;
+		if (k < (int)r.correctionSizes.size()) {
+			Logger::consolePrint("    %-12s %2d iterations, %7.3f ms\n", solverAccelerationName(r.acceleration), k + 1, r.times[k]);
+		} else {
+			Logger::consolePrint("    %-12s not within %d iterations\n", solverAccelerationName(r.acceleration), iterations);
+		}
+	}
+}
+
+vector<SubstepResult> benchmarkSubsteps(double spacing, int steps, const vector<int> &substepCounts, int iterations) {
+	SimulationParams savedParams = ParticleSystem::params;
+	bool savedXpbd = ParticleSystem::xpbdConstraint;
+	bool savedGravity = ParticleSystem::enableGravity;
+	ParticleSystem::params.solverTolerance = 0;
+	ParticleSystem::params.substepIterations = max(iterations, 1);
+	ParticleSystem::enableGravity = true;
+	steps = max(steps, 1);
+
+	// The current scheme first, as the reference
+	vector<int> counts(1, 1);
+	for (int count : substepCounts) {
+		if (count > 1) counts.push_back(count);
+	}
+
+	vector<ParticleInit> initial = damBreakParticles(spacing);
+	vector<SubstepResult> results;
+	for (int xpbd = 0; xpbd < 2; xpbd++) {
+		ParticleSystem::xpbdConstraint = xpbd != 0;
+		for (int count : counts) {
+			ParticleSystem::params.substeps = count;
+			ParticleSystem system(initial);
+
+			SubstepResult result = {};
+			result.substeps = count;
+			result.iterations = count > 1 ? ParticleSystem::params.substepIterations : ParticleSystem::params.maxSolverIterations;
+			result.xpbd = xpbd != 0;
+			for (int s = 0; s < steps; s++) {
+				system.integrate_PBF(ParticleSystem::params.deltaT);
+				const SimulationStats &stats = system.getStats();
+				result.stepTime += stats.stepTime / steps;
+				result.solverTime += stats.solverTime / steps;
+				result.maxSpeed += stats.maxSpeed / steps;
+				result.substepRebuilds += stats.substepRebuilds;
+				result.densityError += system.measureDensityError() / steps;
+			}
+			results.push_back(result);
+		}
+	}
+
+	ParticleSystem::params = savedParams;
+	ParticleSystem::xpbdConstraint = savedXpbd;
+	ParticleSystem::enableGravity = savedGravity;
+	return results;
+}
+
+void runSubstepBenchmark(double spacing, int steps) {
+	vector<int> substepCounts;
+	for (int count = 2; count <= 10; count += count < 4 ? 1 : 2) {
+		substepCounts.push_back(count);
+	}
+	vector<SubstepResult> results = benchmarkSubsteps(spacing, steps, substepCounts, ParticleSystem::params.substepIterations);
+
+	Logger::consolePrint("Substep benchmark: dam break with %d particles, %d steps\n",
+		(int)damBreakParticles(spacing).size(), steps);
+	for (const SubstepResult &r : results) {
+		Logger::consolePrint("  %-4s %2d x %2d iterations: density error %.8f, step %7.2f ms (solver %7.2f), max speed %.3f, %d substep rebuilds\n",
+			r.xpbd ? "XPBD" : "PBF", r.substeps, r.iterations, r.densityError, r.stepTime, r.solverTime, r.maxSpeed, r.substepRebuilds);
+	}
+}
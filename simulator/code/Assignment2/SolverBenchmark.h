@@ -0,0 +1,57 @@
+#pragma once
+
+#include "ParticleSystem.h"
+#include <vector>
+
+// How one solver acceleration converged, averaged over the steps of a benchmark run. Entry k
+// of each array is about iteration k + 1.
+struct SolverConvergenceResult {
+	SolverAcceleration acceleration;
+	// RMS size of the corrections of the iteration, how long into the solver it ended (in
+	// milliseconds), and the mean density error it started from
+	std::vector<double> correctionSizes;
+	std::vector<double> times;
+	std::vector<double> densityErrors;
+	double solverTime;
+	double spectralRadius;
+};
+
+// Particles of a dam break: a column with the given spacing in one corner of the box, 0.6 wide
+// and deep and 1.6 high, that collapses under gravity.
+std::vector<ParticleInit> damBreakParticles(double spacing);
+
+// Lets the dam break collapse for the given number of steps once with each acceleration, always
+// running the given number of iterations, and averages how each of them converged. Every run
+// starts from the same state.
+std::vector<SolverConvergenceResult> benchmarkSolverConvergence(double spacing, int steps, int iterations);
+
+// Runs the benchmark with params.maxSolverIterations iterations and prints the convergence of each
+// acceleration against the iterations and wall time to the console, along with how soon each
+// gets its corrections as small as plain Jacobi does in its last iteration.
+void runSolverBenchmark(double spacing, int steps);
+
+// How the dam break fared with each step split into some number of substeps, averaged over the
+// steps of a benchmark run.
+struct SubstepResult {
+	int substeps;
+	// Solver iterations of each substep
+	int iterations;
+	bool xpbd;
+	// Mean density error at the end of the step (see ParticleSystemT::measureDensityError), and
+	// how long the step and its solver took (in milliseconds)
+	double densityError;
+	double stepTime;
+	double solverTime;
+	double maxSpeed;
+	// Neighbor list rebuilds after the first substep, over the whole run
+	int substepRebuilds;
+};
+
+// Lets the dam break collapse for the given number of steps once for each substep count, with
+// the given iterations per substep, and once with a single substep of params.maxSolverIterations
+// iterations, both with the PBF and the XPBD constraint. Every run starts from the same state.
+std::vector<SubstepResult> benchmarkSubsteps(double spacing, int steps, const std::vector<int> &substepCounts, int iterations);
+
+// Runs the substep benchmark for 2 to 10 substeps of params.substepIterations iterations and prints the density error
+// each gets to against the time its steps took to the console.
+void runSubstepBenchmark(double spacing, int steps);
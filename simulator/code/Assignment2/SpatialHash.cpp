@@ -0,0 +1,165 @@
+#include "SpatialHash.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+SpatialHash::SpatialHash(double h) {
+	slotMask = 0;
+	cellSize = h;
+}
+
+void SpatialHash::setRadius(double r) {
+	if (r != cellSize) {
+		clear();
+	}
+	cellSize = r;
+}
+
+uint64_t SpatialHash::keyOfPosition(const P3D &x, int dx, int dy, int dz) const {
+	return packCellKey((int)floor(x[0] / cellSize) + dx, (int)floor(x[1] / cellSize) + dy, (int)floor(x[2] / cellSize) + dz);
+}
+
+int SpatialHash::findSlot(uint64_t key) const {
+	if (slotKeys.empty()) {
+		return -1;
+	}
+	uint64_t s = mixCellKey(key) & slotMask;
+	while (slotKeys[s] != EMPTY_SLOT) {
+		if (slotKeys[s] == key) {
+			return (int)s;
+		}
+		s = (s + 1) & slotMask;
+	}
+	return -1;
+}
+
+void SpatialHash::clear() {
+	particleKey.clear();
+}
+
+void SpatialHash::add(int i, const P3D &x) {
+	if (i >= (int)particleKey.size()) {
+		particleKey.resize(i + 1);
+	}
+	particleKey[i] = keyOfPosition(x, 0, 0, 0);
+}
+
+void SpatialHash::build() {
+	int n = particleKey.size();
+
+	// Keep at most half of the slots occupied so probe sequences stay short. The table only
+	// grows, so once the particle count is stable the same storage is reused every build.
+	size_t slots = max((size_t)64, slotKeys.size());
+	while (slots < 2 * (size_t)n) {
+		slots *= 2;
+	}
+	slotKeys.resize(slots);
+	fill(slotKeys.begin(), slotKeys.end(), (uint64_t)EMPTY_SLOT);
+	slotStart.assign(slots + 1, 0);
+	slotMask = slots - 1;
+
+	// Insert the cell of every particle, counting particles per slot shifted by one
+	particleSlot.resize(n);
+	for (int i = 0; i < n; i++) {
+		uint64_t key = particleKey[i];
+		uint64_t s = mixCellKey(key) & slotMask;
+		while (slotKeys[s] != EMPTY_SLOT && slotKeys[s] != key) {
+			s = (s + 1) & slotMask;
+		}
+		slotKeys[s] = key;
+		particleSlot[i] = (int)s;
+		slotStart[s + 1]++;
+	}
+	for (size_t s = 0; s < slots; s++) {
+		slotStart[s + 1] += slotStart[s];
+	}
+
+	// Same counting sort scatter as UniformGrid::build
+	sortedIndices.resize(n);
+	for (int i = 0; i < n; i++) {
+		sortedIndices[slotStart[particleSlot[i]]++] = i;
+	}
+	for (size_t s = slots; s > 0; s--) {
+		slotStart[s] = slotStart[s - 1];
+	}
+	slotStart[0] = 0;
+
+	sortedPosition.resize(n);
+	for (int k = 0; k < n; k++) {
+		sortedPosition[sortedIndices[k]] = k;
+	}
+}
+
+// Like UniformGrid::update, re-sorts everything as soon as any particle changed cells, whatever
+// maxChurn says.
+int SpatialHash::update(const PositionArray &x_star, double /*maxChurn*/, bool &rebuilt) {
+	int n = x_star.size();
+	if ((int)particleKey.size() != n) {
+		rebuildAll(x_star);
+		rebuilt = true;
+		return n;
+	}
+
+	int moved = 0;
+	for (int i = 0; i < n; i++) {
+		uint64_t key = keyOfPosition(x_star[i], 0, 0, 0);
+		if (key != particleKey[i]) {
+			particleKey[i] = key;
+			moved++;
+		}
+	}
+	rebuilt = moved > 0;
+	if (rebuilt) {
+		build();
+	}
+	return moved;
+}
+
+void SpatialHash::scanSlot(int slot, int first, const P3D &p_i, const PositionArray &x_star, vector<int> &out) const {
+	double h2 = cellSize * cellSize;
+	for (int k = max(first, slotStart[slot]); k < slotStart[slot + 1]; k++) {
+		int j = sortedIndices[k];
+		V3D diff = p_i - x_star[j];
+		if (diff.length2() < h2) {
+			out.push_back(j);
+		}
+	}
+}
+
+void SpatialHash::findNeighbors(int i, const PositionArray &x_star, vector<int> &out) const {
+	const P3D &p_i = x_star[i];
+	for (int dz = -1; dz <= 1; dz++) {
+		for (int dy = -1; dy <= 1; dy++) {
+			for (int dx = -1; dx <= 1; dx++) {
+				int slot = findSlot(keyOfPosition(p_i, dx, dy, dz));
+				if (slot >= 0) {
+					scanSlot(slot, 0, p_i, x_star, out);
+				}
+			}
+		}
+	}
+}
+
+// Same half stencil as UniformGrid::findHalfNeighbors: the particles after i in its own cell,
+// the cell at +x, the row at (dy, dz) = (+1, 0) and the nine cells at dz = +1.
+void SpatialHash::findHalfNeighbors(int i, const PositionArray &x_star, vector<int> &out) const {
+	const P3D &p_i = x_star[i];
+	scanSlot(particleSlot[i], sortedPosition[i] + 1, p_i, x_star, out);
+
+	auto visit = [&](int dx, int dy, int dz) {
+		int slot = findSlot(keyOfPosition(p_i, dx, dy, dz));
+		if (slot >= 0) {
+			scanSlot(slot, 0, p_i, x_star, out);
+		}
+	};
+	visit(1, 0, 0);
+	for (int dx = -1; dx <= 1; dx++) {
+		visit(dx, 1, 0);
+	}
+	for (int dy = -1; dy <= 1; dy++) {
+		for (int dx = -1; dx <= 1; dx++) {
+			visit(dx, dy, 1);
+		}
+	}
+}
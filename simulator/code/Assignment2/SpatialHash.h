@@ -0,0 +1,64 @@
+#pragma once
+
+#include "NeighborSearch.h"
+#include <stdint.h>
+#include <vector>
+
+// Packs integer cell coordinates (21 bits each, so |x| < 2^20) into a single 64-bit key.
+inline uint64_t packCellKey(int x, int y, int z) {
+	const uint64_t bias = 1 << 20;
+	return (((uint64_t)(x + bias) & 0x1fffff) << 42) | (((uint64_t)(y + bias) & 0x1fffff) << 21) | ((uint64_t)(z + bias) & 0x1fffff);
+}
+
+// Scrambles a cell key so that all of its bits affect the low bits used to pick a slot
+// (the splitmix64 finalizer).
+inline uint64_t mixCellKey(uint64_t key) {
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9ULL;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebULL;
+	key ^= key >> 31;
+	return key;
+}
+
+/**
+ * Spatial hash over an unbounded domain. Occupied cells are stored in an open-addressing
+ * table with a power-of-two number of slots and linear probing, keyed by the mixed cell key.
+ * Like UniformGrid, particles are bucketed by a counting sort over the slots, so every cell
+ * is a range of sortedIndices and there is no per-cell heap storage. The table only grows,
+ * so it is reused from step to step.
+ */
+class SpatialHash : public NeighborSearch {
+private:
+	static const uint64_t EMPTY_SLOT = ~0ULL;
+
+	double cellSize;
+
+	std::vector<uint64_t> slotKeys;
+	// Start offset of every slot in sortedIndices; slotStart[s + 1] - slotStart[s] particles
+	std::vector<int> slotStart;
+	uint64_t slotMask;
+
+	// Cell key and slot of every particle added since the last clear()
+	std::vector<uint64_t> particleKey;
+	std::vector<int> particleSlot;
+	std::vector<int> sortedIndices;
+	std::vector<int> sortedPosition;
+
+	uint64_t keyOfPosition(const P3D &x, int dx, int dy, int dz) const;
+	// Returns the slot holding key, or -1 if the cell is empty.
+	int findSlot(uint64_t key) const;
+	void scanSlot(int slot, int first, const P3D &p_i, const PositionArray &x_star, std::vector<int> &out) const;
+
+public:
+	SpatialHash(double h);
+	void setRadius(double r);
+	void clear();
+	void add(int i, const P3D &x);
+	void build();
+	int update(const PositionArray &x_star, double maxChurn, bool &rebuilt);
+	void findNeighbors(int i, const PositionArray &x_star, std::vector<int> &out) const;
+	void findHalfNeighbors(int i, const PositionArray &x_star, std::vector<int> &out) const;
+
+	int slotCount() const { return (int)slotKeys.size(); }
+};
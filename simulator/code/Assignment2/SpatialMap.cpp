@@ -10,20 +10,32 @@ SpatialMap::SpatialMap(double h) :
 	bucketSize = h;
 }
 
+void SpatialMap::setRadius(double r) {
+	if (r != bucketSize) {
+		clear();
+	}
+	bucketSize = r;
+}
+
 void SpatialMap::clear() {
 	particleMap.clear();
+	particleCell.clear();
 }
 
-IntTriple SpatialMap::indexOfPosition(Particle p) {
+IntTriple SpatialMap::indexOfPosition(const P3D &x) const {
 	IntTriple index;
-	index.x = (int)std::floor(p.x_star[0] / bucketSize);
-	index.y = (int)std::floor(p.x_star[1] / bucketSize);
-	index.z = (int)std::floor(p.x_star[2] / bucketSize);
+	index.x = (int)std::floor(x[0] / bucketSize);
+	index.y = (int)std::floor(x[1] / bucketSize);
+	index.z = (int)std::floor(x[2] / bucketSize);
 	return index;
 }
 
-void SpatialMap::add(int i, Particle p) {
-	IntTriple index = indexOfPosition(p);
+void SpatialMap::add(int i, const P3D &x) {
+	IntTriple index = indexOfPosition(x);
+	if (i >= (int)particleCell.size()) {
+		particleCell.resize(i + 1);
+	}
+	particleCell[i] = index;
 	
 	if (particleMap.count(index) > 0) {
 		//Then the bucket already exists, so just add this to the bin
@@ -36,27 +48,74 @@ void SpatialMap::add(int i, Particle p) {
 	}
 }
 
-bool closeEnough(Particle p1, Particle p2) {
-	V3D diff = p1.x_star - p2.x_star;
-	if (abs(diff[0]) >= KERNEL_H || abs(diff[1]) >= KERNEL_H || abs(diff[2]) >= KERNEL_H) {
+void SpatialMap::removeFromBucket(int i, const IntTriple &index) {
+	auto bucket = particleMap.find(index);
+	vector<int> &members = bucket->second;
+	*find(members.begin(), members.end(), i) = members.back();
+	members.pop_back();
+	if (members.empty()) {
+		particleMap.erase(bucket);
+	}
+}
+
+int SpatialMap::update(const PositionArray &x_star, double maxChurn, bool &rebuilt) {
+	int n = x_star.size();
+	if ((int)particleCell.size() != n) {
+		rebuildAll(x_star);
+		rebuilt = true;
+		return n;
+	}
+
+	movedParticles.clear();
+	movedCells.clear();
+	for (int i = 0; i < n; i++) {
+		IntTriple index = indexOfPosition(x_star[i]);
+		if (!(index == particleCell[i])) {
+			movedParticles.push_back(i);
+			movedCells.push_back(index);
+		}
+	}
+
+	int moved = movedParticles.size();
+	if (moved > maxChurn * n) {
+		rebuildAll(x_star);
+		rebuilt = true;
+		return moved;
+	}
+
+	// Only patch the buckets the moved particles leave and enter
+	for (int k = 0; k < moved; k++) {
+		int i = movedParticles[k];
+		removeFromBucket(i, particleCell[i]);
+		particleMap[movedCells[k]].push_back(i);
+		particleCell[i] = movedCells[k];
+	}
+	rebuilt = false;
+	return moved;
+}
+
+bool closeEnough(const P3D &x1, const P3D &x2, double h) {
+	V3D diff = x1 - x2;
+	if (abs(diff[0]) >= h || abs(diff[1]) >= h || abs(diff[2]) >= h) {
 		return false;
 	}
-	return (diff.norm() < KERNEL_H);
+	return (diff.norm() < h);
 }
 
-void SpatialMap::findNeighbors(Particle &p_i, vector<Particle> &particles) {
+void SpatialMap::findNeighbors(int i, const PositionArray &x_star, vector<int> &out) const {
+	const P3D &p_i = x_star[i];
 	IntTriple index = indexOfPosition(p_i);
-	p_i.neighbors.clear();
 
 	// Look in all neighboring grid cells
 	for (int dx = -1; dx <= 1; dx++) {
 		for (int dy = -1; dy <= 1; dy++) {
 			for (int dz = -1; dz <= 1; dz++) {
 				IntTriple neighborIndex = index.addOffset(dx, dy, dz);
-				if (particleMap.count(neighborIndex) == 0) continue;
-				for (auto &j : particleMap[neighborIndex]) {
-					if (closeEnough(p_i, particles[j])) {
-						p_i.neighbors.push_back(j);
+				auto bucket = particleMap.find(neighborIndex);
+				if (bucket == particleMap.end()) continue;
+				for (int j : bucket->second) {
+					if (closeEnough(p_i, x_star[j], bucketSize)) {
+						out.push_back(j);
 					}
 				}
 			}
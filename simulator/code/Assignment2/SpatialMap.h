@@ -1,6 +1,8 @@
 #pragma once
 
-#include "Particle.h"
+#include "ParticleStore.h"
+#include "NeighborSearch.h"
+#include "SpatialHash.h"
 #include <unordered_map>
 
 struct IntTriple {
@@ -20,20 +22,28 @@ struct IntTriple {
 };
 
 inline std::size_t triple_hash(const IntTriple &t)  {
-	return 31 * t.x + 73 * t.y + t.z;
+	return (std::size_t)mixCellKey(packCellKey(t.x, t.y, t.z));
 }
 
 typedef std::unordered_map<IntTriple, std::vector<int>, decltype(&triple_hash)> MapType;
 
-class SpatialMap {
+class SpatialMap : public NeighborSearch {
 private:
 	MapType particleMap;
 	double bucketSize;
+	// Cell of every particle added since the last clear(), and scratch for update()
+	std::vector<IntTriple> particleCell;
+	std::vector<int> movedParticles;
+	std::vector<IntTriple> movedCells;
+
+	void removeFromBucket(int i, const IntTriple &index);
 
 public:
 	SpatialMap(double h);
+	void setRadius(double r);
 	void clear();
-	IntTriple indexOfPosition(Particle p);
-	void add(int i, Particle p);
-	void findNeighbors(Particle &p, std::vector<Particle> &particles);
+	IntTriple indexOfPosition(const P3D &x) const;
+	void add(int i, const P3D &x);
+	int update(const PositionArray &x_star, double maxChurn, bool &rebuilt);
+	void findNeighbors(int i, const PositionArray &x_star, std::vector<int> &out) const;
 };
\ No newline at end of file
@@ -0,0 +1,202 @@
+#include "UniformGrid.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+UniformGrid::UniformGrid(double h, P3D minCorner, P3D maxCorner) {
+	origin = minCorner;
+	corner = maxCorner;
+	cellSize = 0;
+	setRadius(h);
+}
+
+void UniformGrid::setRadius(double r) {
+	if (r == cellSize) return;
+	cellSize = r;
+	for (int axis = 0; axis < 3; axis++) {
+		dims[axis] = max(1, (int)ceil((corner[axis] - origin[axis]) / r));
+	}
+	cellStart.assign(cellCount() + 1, 0);
+	particleCell.clear();
+}
+
+int UniformGrid::cellCoord(double x, int axis) const {
+	int c = (int)floor((x - origin[axis]) / cellSize);
+	return min(max(c, 0), dims[axis] - 1);
+}
+
+int UniformGrid::cellOf(const P3D &x) const {
+	return (cellCoord(x[2], 2) * dims[1] + cellCoord(x[1], 1)) * dims[0] + cellCoord(x[0], 0);
+}
+
+void UniformGrid::clear() {
+	particleCell.clear();
+}
+
+void UniformGrid::add(int i, const P3D &x) {
+	if (i >= (int)particleCell.size()) {
+		particleCell.resize(i + 1, -1);
+	}
+	particleCell[i] = cellOf(x);
+}
+
+void UniformGrid::build() {
+	int n = particleCell.size();
+	int cells = cellCount();
+	int threads = threadCount();
+	threadCellCounts.resize(threads);
+	threadCellTotals.resize(threads + 1);
+
+	// Count the particles of each thread's range in each cell
+	forEachRange(n, [&](int begin, int end, int t) {
+		vector<int> &counts = threadCellCounts[t];
+		counts.assign(cells, 0);
+		for (int i = begin; i < end; i++) {
+			counts[particleCell[i]]++;
+		}
+	});
+
+	// Prefix sum over the cells, and within each cell over the threads, so that counts become
+	// the slot where each thread starts writing its particles of that cell. The cells are
+	// split among the threads as well: each sums its cells, and then offsets them by the
+	// total of the cells before.
+	forEachRange(cells, [&](int begin, int end, int t) {
+		int total = 0;
+		for (int c = begin; c < end; c++) {
+			for (int s = 0; s < threads; s++) {
+				total += threadCellCounts[s][c];
+			}
+		}
+		threadCellTotals[t + 1] = total;
+	});
+	threadCellTotals[0] = 0;
+	for (int t = 0; t < threads; t++) {
+		threadCellTotals[t + 1] += threadCellTotals[t];
+	}
+	forEachRange(cells, [&](int begin, int end, int t) {
+		int start = threadCellTotals[t];
+		for (int c = begin; c < end; c++) {
+			cellStart[c] = start;
+			for (int s = 0; s < threads; s++) {
+				int count = threadCellCounts[s][c];
+				threadCellCounts[s][c] = start;
+				start += count;
+			}
+		}
+	});
+	cellStart[cells] = n;
+
+	// Scatter the particles into their cells
+	sortedIndices.resize(n);
+	forEachRange(n, [&](int begin, int end, int t) {
+		vector<int> &slots = threadCellCounts[t];
+		for (int i = begin; i < end; i++) {
+			sortedIndices[slots[particleCell[i]]++] = i;
+		}
+	});
+
+	sortedPosition.resize(n);
+	forEachRange(n, [&](int begin, int end, int) {
+		for (int k = begin; k < end; k++) {
+			sortedPosition[sortedIndices[k]] = k;
+		}
+	});
+}
+
+// The counting sort is already linear and allocation-free, so patching single cells would not
+// pay off: the grid is re-sorted as soon as any particle changed cells, whatever maxChurn says,
+// and kept as is otherwise.
+int UniformGrid::update(const PositionArray &x_star, double /*maxChurn*/, bool &rebuilt) {
+	int n = x_star.size();
+	if ((int)particleCell.size() != n) {
+		rebuildAll(x_star);
+		rebuilt = true;
+		return n;
+	}
+
+	threadMoved.assign(threadCount(), 0);
+	forEachRange(n, [&](int begin, int end, int t) {
+		int moved = 0;
+		for (int i = begin; i < end; i++) {
+			int c = cellOf(x_star[i]);
+			if (c != particleCell[i]) {
+				particleCell[i] = c;
+				moved++;
+			}
+		}
+		threadMoved[t] = moved;
+	});
+	int moved = 0;
+	for (int m : threadMoved) {
+		moved += m;
+	}
+	rebuilt = moved > 0;
+	if (rebuilt) {
+		build();
+	}
+	return moved;
+}
+
+void UniformGrid::findNeighbors(int i, const PositionArray &x_star, vector<int> &out) const {
+	const P3D &p_i = x_star[i];
+	int cx = cellCoord(p_i[0], 0);
+	int cy = cellCoord(p_i[1], 1);
+	int cz = cellCoord(p_i[2], 2);
+	double h2 = cellSize * cellSize;
+
+	// Cells along x are contiguous in sortedIndices, so each row of three cells is one range
+	int x0 = max(cx - 1, 0);
+	int x1 = min(cx + 1, dims[0] - 1);
+	for (int z = max(cz - 1, 0); z <= min(cz + 1, dims[2] - 1); z++) {
+		for (int y = max(cy - 1, 0); y <= min(cy + 1, dims[1] - 1); y++) {
+			int row = (z * dims[1] + y) * dims[0];
+			for (int k = cellStart[row + x0]; k < cellStart[row + x1 + 1]; k++) {
+				int j = sortedIndices[k];
+				V3D diff = p_i - x_star[j];
+				if (diff.length2() < h2) {
+					out.push_back(j);
+				}
+			}
+		}
+	}
+}
+
+// Half stencil: the particles after i in its own cell, the cell at +x, and the 12 cells of
+// the rows at (dy, dz) = (+1, 0) and (-1..1, +1). Every pair of neighboring cells is then
+// visited from exactly one side.
+void UniformGrid::findHalfNeighbors(int i, const PositionArray &x_star, vector<int> &out) const {
+	const P3D &p_i = x_star[i];
+	int cx = cellCoord(p_i[0], 0);
+	int cy = cellCoord(p_i[1], 1);
+	int cz = cellCoord(p_i[2], 2);
+	double h2 = cellSize * cellSize;
+
+	auto scan = [&](int first, int last) {
+		for (int k = first; k < last; k++) {
+			int j = sortedIndices[k];
+			V3D diff = p_i - x_star[j];
+			if (diff.length2() < h2) {
+				out.push_back(j);
+			}
+		}
+	};
+
+	int x0 = max(cx - 1, 0);
+	int x1 = min(cx + 1, dims[0] - 1);
+
+	// Own cell after i, followed by the cell at +x, which is contiguous with it
+	int row = (cz * dims[1] + cy) * dims[0];
+	scan(sortedPosition[i] + 1, cellStart[row + x1 + 1]);
+
+	if (cy + 1 < dims[1]) {
+		row = (cz * dims[1] + cy + 1) * dims[0];
+		scan(cellStart[row + x0], cellStart[row + x1 + 1]);
+	}
+	if (cz + 1 < dims[2]) {
+		for (int y = max(cy - 1, 0); y <= min(cy + 1, dims[1] - 1); y++) {
+			row = ((cz + 1) * dims[1] + y) * dims[0];
+			scan(cellStart[row + x0], cellStart[row + x1 + 1]);
+		}
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "NeighborSearch.h"
+#include "MathLib/P3D.h"
+#include <vector>
+
+/**
+ * Dense grid of cells of size h over a fixed bounding box. Particles are bucketed with a
+ * counting sort: after build(), the particles in cell c are
+ * sortedIndices[cellStart[c]] ... sortedIndices[cellStart[c + 1] - 1].
+ * All arrays are reused from step to step, so rebuilding costs O(N) and never allocates
+ * once the particle count is stable. Positions outside the box are clamped to the border cells.
+ * With a thread pool, every thread counts and scatters its own range of particles; the order
+ * within each cell is the same as when sorting serially.
+ */
+class UniformGrid : public NeighborSearch {
+private:
+	double cellSize;
+	P3D origin, corner;
+	int dims[3];
+
+	// Cell index of every particle added since the last clear()
+	std::vector<int> particleCell;
+	// Start offset of every cell in sortedIndices, plus one past the end
+	std::vector<int> cellStart;
+	// Particle indices ordered by cell, and the position of every particle in that order
+	std::vector<int> sortedIndices;
+	std::vector<int> sortedPosition;
+	// Particles of each thread's range per cell, turned into that range's first slot in
+	// sortedIndices for each cell, and the number of particles in each thread's range of cells
+	std::vector<std::vector<int>> threadCellCounts;
+	std::vector<int> threadCellTotals;
+	std::vector<int> threadMoved;
+
+	int cellCoord(double x, int axis) const;
+	int cellOf(const P3D &x) const;
+
+public:
+	UniformGrid(double h, P3D minCorner, P3D maxCorner);
+	void setRadius(double r);
+	void clear();
+	void add(int i, const P3D &x);
+	void build();
+	int update(const PositionArray &x_star, double maxChurn, bool &rebuilt);
+	void findNeighbors(int i, const PositionArray &x_star, std::vector<int> &out) const;
+	void findHalfNeighbors(int i, const PositionArray &x_star, std::vector<int> &out) const;
+
+	int cellCount() const { return dims[0] * dims[1] * dims[2]; }
+};
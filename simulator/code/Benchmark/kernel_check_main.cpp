@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <limits>
+#include <vector>
+#include "Assignment2/SPHKernels.h"
+
+using namespace std;
+
+static void printUsage() {
+	fprintf(stderr,
+		"usage: kernel_check [options]\n"
+		"  --h <h>            kernel radius (default 0.1)\n"
+		"  --samples <n>      random offsets per check (default 100000)\n"
+		"  --csv <file>       write the results there instead of stdout\n");
+}
+
+static double randomUnit() {
+	return (double)rand() / RAND_MAX;
+}
+
+// Offsets in random directions, with lengths uniform in [minLength, maxLength]
+static vector<Eigen::Vector3d> randomOffsets(int count, double minLength, double maxLength) {
+	vector<Eigen::Vector3d> offsets;
+	while ((int)offsets.size() < count) {
+		Eigen::Vector3d d(2 * randomUnit() - 1, 2 * randomUnit() - 1, 2 * randomUnit() - 1);
+		double length = d.norm();
+		if (length > 1 || length < 1e-3) continue;
+		offsets.push_back(d * ((minLength + (maxLength - minLength) * randomUnit()) / length));
+	}
+	return offsets;
+}
+
+// The offsets of length h along the three axes
+static void appendAxes(vector<Eigen::Vector3d> &offsets, double h) {
+	for (int axis = 0; axis < 3; axis++) {
+		Eigen::Vector3d d = Eigen::Vector3d::Zero();
+		d[axis] = h;
+		offsets.push_back(d);
+	}
+}
+
+// The larger of two errors, where NaN counts as larger than anything
+static double worst(double a, double b) {
+	return isnan(a) || a >= b ? a : b;
+}
+
+template<typename Scalar>
+static const char *scalarName() {
+	return sizeof(Scalar) == sizeof(float) ? "float" : "double";
+}
+
+// One CSV row per kernel, precision and check, with the largest error found and what it may be
+struct Report {
+	FILE *out;
+	int failures;
+
+	void add(const char *kernel, const char *scalar, const char *check, int samples, double error, double tolerance) {
+		bool passed = error <= tolerance;
+		fprintf(out, "%s,%s,%s,%d,%.3e,%.3e,%s\n", kernel, scalar, check, samples, error, tolerance, passed ? "yes" : "no");
+		fflush(out);
+		if (!passed) failures++;
+	}
+};
+
+// poly6() and spiky() as ParticleSystem evaluated them before the kernels were precomputed. spiky
+// returned the gradient with respect to the first particle if wrt_first, and minus it otherwise.
+template<typename Scalar>
+static Scalar oldPoly6(const Eigen::Matrix<Scalar, 3, 1> &r, Scalar h) {
+	if (r.norm() > h) {
+		return 0;
+	}
+
+	Scalar coeff = (Scalar)(315.0 / 64.0 / PI / pow((double)h, 9));
+	Scalar term = pow(h * h - r.squaredNorm(), 3);
+
+	return coeff * term;
+}
+
+template<typename Scalar>
+static Eigen::Matrix<Scalar, 3, 1> oldSpiky(const Eigen::Matrix<Scalar, 3, 1> &r, Scalar h, bool wrt_first) {
+	if (r.norm() > h) {
+		return Eigen::Matrix<Scalar, 3, 1>::Zero();
+	}
+
+	Scalar coeff = (Scalar)(-45.0 / PI / pow((double)h, 6));
+	Scalar term = pow(h - r.norm(), 2);
+	Eigen::Matrix<Scalar, 3, 1> dir = wrt_first ? r.normalized() : -r.normalized();
+
+	return dir * (coeff * term);
+}
+
+// Poly6Kernel and SpikyKernel against the formulas they replaced. The old spiky gradient is NaN
+// at r = 0, where the new one is 0, so r = 0 is only compared for poly6.
+template<typename Scalar>
+static void checkOldFormulas(Report &report, double h, int samples) {
+	typedef Eigen::Matrix<Scalar, 3, 1> Vector3;
+	Poly6Kernel<Scalar> poly6(h);
+	SpikyKernel<Scalar> spiky(h);
+	Scalar oldH = (Scalar)h;
+	double valueScale = 315.0 / 64.0 / PI / pow(h, 3), gradientScale = 15.0 / PI / pow(h, 4);
+	double tolerance = 100 * numeric_limits<Scalar>::epsilon();
+
+	vector<Eigen::Vector3d> offsets = randomOffsets(samples, 0, 1.1 * h);
+	offsets.push_back(Eigen::Vector3d::Zero());
+	appendAxes(offsets, h);
+
+	double valueError = 0, gradientError = 0;
+	for (const Eigen::Vector3d &d : offsets) {
+		Vector3 r = d.cast<Scalar>();
+		valueError = worst(valueError, fabs(poly6(r) - oldPoly6(r, oldH)) / valueScale);
+		if (r.squaredNorm() > 0) {
+			gradientError = worst(gradientError, (double)(spiky.gradient(r) - oldSpiky(r, oldH, true)).norm() / gradientScale);
+			gradientError = worst(gradientError, (double)(spiky.gradient(r) + oldSpiky(r, oldH, false)).norm() / gradientScale);
+		}
+	}
+	report.add("poly6", scalarName<Scalar>(), "old_formula", (int)offsets.size(), valueError, tolerance);
+	report.add("spiky", scalarName<Scalar>(), "old_formula", (int)offsets.size(), gradientError, tolerance);
+}
+
+// The checks of one kernel in one precision. Errors are relative to W(0) for values and to
+// W(0) / h for gradients, the scales the kernels take within their support.
+template<template<typename> class Kernel, typename Scalar>
+static void checkKernel(Report &report, const char *name, double h, double origin, int samples) {
+	typedef Eigen::Matrix<Scalar, 3, 1> Vector3;
+	Kernel<Scalar> kernel(h);
+	const char *scalar = scalarName<Scalar>();
+	double eps = numeric_limits<Scalar>::epsilon();
+	double gradientScale = origin / h;
+	double roundoff = 100 * eps;
+
+	// At r = 0, W(0) from its formula and no gradient
+	Vector3 zero = Vector3::Zero();
+	double error = worst(fabs(kernel(zero) - origin) / origin, (double)kernel.gradient(zero).norm() / gradientScale);
+	report.add(name, scalar, "origin", 1, error, roundoff);
+
+	// At r = h and beyond, neither
+	vector<Eigen::Vector3d> offsets = randomOffsets(samples, h, 2 * h);
+	appendAxes(offsets, h);
+	error = 0;
+	for (const Eigen::Vector3d &d : offsets) {
+		Vector3 r = d.cast<Scalar>();
+		error = worst(error, fabs(kernel(r)) / origin);
+		error = worst(error, (double)kernel.gradient(r).norm() / gradientScale);
+	}
+	report.add(name, scalar, "support", (int)offsets.size(), error, roundoff);
+
+	// The gradient against central differences of W, with steps that balance their truncation and
+	// rounding errors. The gradients curve more sharply the closer to r = 0, so the step shrinks
+	// with |r|, and the cusp of the spiky kernel at r = 0 is left out.
+	offsets = randomOffsets(samples, 0.05 * h, 1.05 * h);
+	error = 0;
+	for (const Eigen::Vector3d &d : offsets) {
+		Vector3 r = d.cast<Scalar>();
+		Scalar step = (Scalar)(d.norm() * cbrt(eps));
+		Vector3 difference;
+		for (int k = 0; k < 3; k++) {
+			Vector3 plus = r, minus = r;
+			plus[k] += step;
+			minus[k] -= step;
+			difference[k] = (kernel(plus) - kernel(minus)) / (plus[k] - minus[k]);
+		}
+		error = worst(error, (double)(difference - kernel.gradient(r)).norm() / gradientScale);
+	}
+	report.add(name, scalar, "finite_differences", (int)offsets.size(), error, 100 * pow(eps, 2.0 / 3.0));
+
+	// sample() against the separate evaluations
+	offsets = randomOffsets(samples, 0, 1.1 * h);
+	offsets.push_back(Eigen::Vector3d::Zero());
+	error = 0;
+	for (const Eigen::Vector3d &d : offsets) {
+		Vector3 r = d.cast<Scalar>();
+		KernelSample<Scalar> s = kernel.sample(r);
+		error = worst(error, fabs(s.distance - r.norm()) / h);
+		error = worst(error, fabs(s.value - kernel(r)) / origin);
+		error = worst(error, (double)(s.gradient - kernel.gradient(r)).norm() / gradientScale);
+	}
+	report.add(name, scalar, "sample", (int)offsets.size(), error, roundoff);
+}
+
+// The single precision kernel against the double precision one, at the same offsets
+template<template<typename> class Kernel>
+static void compareScalarTypes(Report &report, const char *name, double h, double origin, int samples) {
+	Kernel<float> single(h);
+	Kernel<double> reference(h);
+	vector<Eigen::Vector3d> offsets = randomOffsets(samples, 0, 1.1 * h);
+	double error = 0;
+	for (const Eigen::Vector3d &d : offsets) {
+		Eigen::Vector3f r = d.cast<float>();
+		error = worst(error, fabs(single(r) - reference(d)) / origin);
+		error = worst(error, (single.gradient(r).template cast<double>() - reference.gradient(d)).norm() / (origin / h));
+	}
+	report.add(name, "float", "double_reference", (int)offsets.size(), error, 100 * numeric_limits<float>::epsilon());
+}
+
+template<typename Scalar>
+static void checkPrecision(Report &report, double h, int samples) {
+	checkOldFormulas<Scalar>(report, h, samples);
+	checkKernel<Poly6Kernel, Scalar>(report, "poly6", h, 315.0 / 64.0 / PI / pow(h, 3), samples);
+	checkKernel<SpikyKernel, Scalar>(report, "spiky", h, 15.0 / PI / pow(h, 3), samples);
+	checkKernel<CubicSplineKernel, Scalar>(report, "cubic_spline", h, 8.0 / PI / pow(h, 3), samples);
+	checkKernel<WendlandC2Kernel, Scalar>(report, "wendland_c2", h, 21.0 / 2.0 / PI / pow(h, 3), samples);
+}
+
+// Checks every kernel of SPHKernels.h in both precisions: poly6 and spiky against the pow()
+// formulas they replaced, the values at r = 0 and from r = h on, the gradients against finite
+// differences of the values, sample() against the separate evaluations, and float against
+// double. Prints one CSV row per check and returns a non-zero exit status if any fails, so that
+// the check can be used in regression scripts.
+int main(int argc, char **argv) {
+	double h = 0.1;
+	int samples = 100000;
+	const char *csvPath = NULL;
+
+	for (int a = 1; a < argc; a++) {
+		bool hasValue = a + 1 < argc;
+		if (!strcmp(argv[a], "--h") && hasValue) {
+			h = atof(argv[++a]);
+		} else if (!strcmp(argv[a], "--samples") && hasValue) {
+			samples = atoi(argv[++a]);
+		} else if (!strcmp(argv[a], "--csv") && hasValue) {
+			csvPath = argv[++a];
+		} else {
+			printUsage();
+			return 2;
+		}
+	}
+	if (h <= 0 || samples < 1) {
+		printUsage();
+		return 2;
+	}
+
+	Report report = { csvPath ? fopen(csvPath, "wt") : stdout, 0 };
+	if (!report.out) {
+		fprintf(stderr, "cannot open %s\n", csvPath);
+		return 2;
+	}
+	fprintf(report.out, "kernel,scalar,check,samples,max_error,tolerance,passed\n");
+
+	srand(467);
+	checkPrecision<float>(report, h, samples);
+	checkPrecision<double>(report, h, samples);
+	compareScalarTypes<Poly6Kernel>(report, "poly6", h, 315.0 / 64.0 / PI / pow(h, 3), samples);
+	compareScalarTypes<SpikyKernel>(report, "spiky", h, 15.0 / PI / pow(h, 3), samples);
+	compareScalarTypes<CubicSplineKernel>(report, "cubic_spline", h, 8.0 / PI / pow(h, 3), samples);
+	compareScalarTypes<WendlandC2Kernel>(report, "wendland_c2", h, 21.0 / 2.0 / PI / pow(h, 3), samples);
+
+	if (report.out != stdout) {
+		fclose(report.out);
+	}
+	if (report.failures > 0) {
+		fprintf(stderr, "%d kernel checks failed\n", report.failures);
+	}
+	return report.failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "Assignment2/KernelBenchmark.h"
+
+using namespace std;
+
+static void printUsage() {
+	fprintf(stderr,
+		"usage: kernel_benchmark [options]\n"
+		"  --ratios <r1,r2,...>    kernelH in lattice spacings (default 1.5,2,2.5,3)\n"
+		"  --particles <n>         particles in the lattice (default 27000)\n"
+		"  --jitter <j>            random displacement in spacings (default 0.1)\n"
+		"  --simd <level>          0 scalar, 1 SSE4, 2 AVX2, 3 AVX-512 (default: widest supported)\n"
+		"  --repeat <r>            runs per measurement, the best is kept (default 3)\n"
+		"  --csv <file>            write the results there instead of stdout\n");
+}
+
+static vector<double> parseRatios(const char *list) {
+	vector<double> ratios;
+	for (const char *s = list; *s; ) {
+		ratios.push_back(atof(s));
+		const char *comma = strchr(s, ',');
+		if (!comma) break;
+		s = comma + 1;
+	}
+	return ratios;
+}
+
+// Prints one CSV row per kernel family and support ratio: the cost of evaluating the kernels
+// of every neighbor pair, and how far the SPH density is from the density of the lattice.
+int main(int argc, char **argv) {
+	vector<double> ratios = parseRatios("1.5,2,2.5,3");
+	int particles = 27000;
+	double jitter = 0.1;
+	SimdLevel level = hostSimdLevel();
+	int repeats = 3;
+	const char *csvPath = NULL;
+
+	for (int a = 1; a < argc; a++) {
+		bool hasValue = a + 1 < argc;
+		if (!strcmp(argv[a], "--ratios") && hasValue) {
+			ratios = parseRatios(argv[++a]);
+		} else if (!strcmp(argv[a], "--particles") && hasValue) {
+			particles = atoi(argv[++a]);
+		} else if (!strcmp(argv[a], "--jitter") && hasValue) {
+			jitter = atof(argv[++a]);
+		} else if (!strcmp(argv[a], "--simd") && hasValue) {
+			level = (SimdLevel)min(max(atoi(argv[++a]), 0), SIMD_LEVEL_COUNT - 1);
+		} else if (!strcmp(argv[a], "--repeat") && hasValue) {
+			repeats = atoi(argv[++a]);
+		} else if (!strcmp(argv[a], "--csv") && hasValue) {
+			csvPath = argv[++a];
+		} else {
+			printUsage();
+			return 2;
+		}
+	}
+	if (level > hostSimdLevel()) {
+		fprintf(stderr, "%s is not supported here, using %s\n", simdLevelName(level), simdLevelName(hostSimdLevel()));
+		level = hostSimdLevel();
+	}
+
+	FILE *out = csvPath ? fopen(csvPath, "wt") : stdout;
+	if (!out) {
+		fprintf(stderr, "cannot open %s\n", csvPath);
+		return 2;
+	}
+	fprintf(out, "family,support_ratio,particles,neighbors,simd,eval_ms,ns_per_pair,density_bias,density_rms,density_max\n");
+
+	for (double ratio : ratios) {
+		if (ratio <= 0) {
+			printUsage();
+			return 2;
+		}
+		vector<KernelBenchmarkResult> results = benchmarkKernelFamilies(ratio, particles, jitter, level, repeats);
+		for (const KernelBenchmarkResult &r : results) {
+			fprintf(out, "%s,%.3f,%d,%.2f,%s,%.3f,%.3f,%.6f,%.6f,%.6f\n", r.family.c_str(), r.supportRatio, r.particles, r.neighbors,
+				simdLevelName(level), r.evaluateTime, r.pairTime, r.densityBias, r.densityError, r.maxDensityError);
+			fflush(out);
+		}
+	}
+
+	if (out != stdout) {
+		fclose(out);
+	}
+	return 0;
+}
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "Assignment2/NeighborBenchmark.h"
+
+using namespace std;
+
+static void printUsage() {
+	fprintf(stderr,
+		"usage: neighbor_benchmark [options]\n"
+		"  --distribution uniform|clustered|mesh   particle cloud to generate (default uniform)\n"
+		"  --mesh <file.obj>                       mesh to tile for the mesh distribution\n"
+		"  --sizes <n1,n2,...>                     particle counts (default 10000,100000)\n"
+		"  --verify <k>                            particles checked against brute force (default 1000)\n"
+		"  --repeat <r>                            runs per measurement, the best is kept (default 3)\n"
+		"  --csv <file>                            write the results there instead of stdout\n");
+}
+
+static vector<int> parseSizes(const char *list) {
+	vector<int> sizes;
+	for (const char *s = list; *s; ) {
+		sizes.push_back(atoi(s));
+		const char *comma = strchr(s, ',');
+		if (!comma) break;
+		s = comma + 1;
+	}
+	return sizes;
+}
+
+// Prints one CSV row per backend and cloud size, and returns a non-zero exit status if any
+// backend disagreed with brute force, so that the benchmark can be used in regression scripts.
+int main(int argc, char **argv) {
+	string distribution = "uniform";
+	string mesh = "../meshes/bunny670.obj";
+	vector<int> sizes;
+	sizes.push_back(10000);
+	sizes.push_back(100000);
+	int verifyCount = 1000;
+	int repeats = 3;
+	const char *csvPath = NULL;
+
+	for (int a = 1; a < argc; a++) {
+		bool hasValue = a + 1 < argc;
+		if (!strcmp(argv[a], "--distribution") && hasValue) {
+			distribution = argv[++a];
+		} else if (!strcmp(argv[a], "--mesh") && hasValue) {
+			mesh = argv[++a];
+		} else if (!strcmp(argv[a], "--sizes") && hasValue) {
+			sizes = parseSizes(argv[++a]);
+		} else if (!strcmp(argv[a], "--verify") && hasValue) {
+			verifyCount = atoi(argv[++a]);
+		} else if (!strcmp(argv[a], "--repeat") && hasValue) {
+			repeats = atoi(argv[++a]);
+		} else if (!strcmp(argv[a], "--csv") && hasValue) {
+			csvPath = argv[++a];
+		} else {
+			printUsage();
+			return 2;
+		}
+	}
+	if (distribution != "uniform" && distribution != "clustered" && distribution != "mesh") {
+		printUsage();
+		return 2;
+	}
+
+	FILE *out = csvPath ? fopen(csvPath, "wt") : stdout;
+	if (!out) {
+		fprintf(stderr, "cannot open %s\n", csvPath);
+		return 2;
+	}
+	fprintf(out, "cloud,particles,backend,build_ms,query_ms,half_query_ms,pairs,half_pairs,checked,mismatches\n");
+
+	int failures = 0;
+	for (int n : sizes) {
+		BenchmarkCloud cloud;
+		if (distribution == "clustered") {
+			cloud = makeClusteredCloud(n);
+		} else if (distribution == "mesh") {
+			cloud = makeMeshCloud(mesh, n);
+		} else {
+			cloud = makeUniformCloud(n);
+		}
+		if (cloud.positions.empty()) {
+			fprintf(stderr, "no particles in %s cloud\n", cloud.name.c_str());
+			return 2;
+		}
+
+		vector<NeighborBenchmarkResult> results = benchmarkNeighborBackends(cloud, verifyCount, repeats);
+		for (const NeighborBenchmarkResult &r : results) {
+			fprintf(out, "%s,%d,%s,%.3f,%.3f,%.3f,%lld,%lld,%d,%d\n", cloud.name.c_str(), (int)cloud.positions.size(),
+				r.backend.c_str(), r.buildTime, r.queryTime, r.halfQueryTime, r.pairs, r.halfPairs, r.checkedParticles, r.mismatches);
+			fflush(out);
+			if (r.mismatches > 0) {
+				fprintf(stderr, "%s: %d mismatches against brute force on %s (%d particles)\n",
+					r.backend.c_str(), r.mismatches, cloud.name.c_str(), (int)cloud.positions.size());
+				failures++;
+			}
+		}
+	}
+
+	if (out != stdout) {
+		fclose(out);
+	}
+	return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "Assignment2/ParticleSystem.h"
+#include "Assignment2/NeighborBenchmark.h"
+
+using namespace std;
+
+static void printUsage() {
+	fprintf(stderr,
+		"usage: precision_check [options]\n"
+		"  --meshes <a.obj,b.obj,...>   scenes to drop (default the bunnies)\n"
+		"  --frames <n>                 frames to simulate, of 1/30 s each (default 5)\n"
+		"  --tolerance <t>              largest distance allowed between the two runs, in kernel radii\n"
+		"                               (default one per bunny, and 0.1 for other scenes)\n"
+		"  --csv <file>                 write the results there instead of stdout\n");
+}
+
+static vector<string> parseList(const char *list) {
+	vector<string> items;
+	for (const char *s = list; *s; ) {
+		const char *comma = strchr(s, ',');
+		items.push_back(comma ? string(s, comma) : string(s));
+		if (!comma) break;
+		s = comma + 1;
+	}
+	return items;
+}
+
+// A particle system of one precision, and where each of the initial particles is now, as the
+// systems reorder their particles independently of each other.
+template<typename Scalar>
+struct TrackedSystem {
+	ParticleSystemT<Scalar, PBF_KERNELS> system;
+	vector<int> indexOf;
+
+	explicit TrackedSystem(vector<ParticleInit> &particles) : system(particles), indexOf(particles.size()) {
+		for (int i = 0; i < (int)indexOf.size(); i++) {
+			indexOf[i] = i;
+		}
+	}
+
+	// Takes a step and returns the largest speed of a particle over it
+	double step(double delta) {
+		vector<P3D> before(indexOf.size());
+		for (int i = 0; i < (int)indexOf.size(); i++) {
+			before[i] = positionOf(i);
+		}
+		system.integrate_PBF(delta);
+		if (system.wasReordered()) {
+			for (int &index : indexOf) {
+				index = system.getNewIndex(index);
+			}
+		}
+
+		double fastest = 0;
+		for (int i = 0; i < (int)indexOf.size(); i++) {
+			fastest = max(fastest, (positionOf(i) - before[i]).length() / delta);
+		}
+		return fastest;
+	}
+
+	P3D positionOf(int i) { return system.getPositionOf(indexOf[i]); }
+};
+
+// How far apart the two runs of each default scene may end up within the checked frames, in
+// kernel radii: a few times what they were measured at over 5 frames. The runs drift apart like
+// any two chaotic trajectories, so only the first frames, while the bunny falls and first
+// splashes, are compared. bunny2500.obj is packed so densely that it bursts apart within the
+// first frame in either precision; it is run all the same, and reported as unstable.
+struct SceneCheck {
+	const char *mesh;
+	double tolerance;
+	bool knownUnstable;
+};
+
+static const SceneCheck defaultScenes[] = {
+	{ "../meshes/bunny200.obj", 0.01, false },
+	{ "../meshes/bunny300.obj", 0.005, false },
+	{ "../meshes/bunny450.obj", 0.01, false },
+	{ "../meshes/bunny670.obj", 0.2, false },
+	{ "../meshes/bunny2500.obj", 0, true },
+};
+
+// A run has burst apart once some particle moves further than this many kernel radii in one
+// step. The bunnies all start packed a little too densely, and the first splash of bunny670
+// reaches about three.
+static const double MAX_STABLE_STEP = 4;
+
+// Drops every scene once in single and once in double precision, the way the application steps
+// them, and compares the positions of every particle after each frame. Prints one CSV row per
+// scene and frame with the RMS and largest distance between the two runs in kernel radii, and
+// the largest speed in each run. Returns a non-zero exit status if any distance is above the
+// tolerance of its scene, or a scene not known to be unstable becomes so, so that the check can
+// be used in regression scripts.
+int main(int argc, char **argv) {
+	vector<SceneCheck> scenes(defaultScenes, defaultScenes + sizeof(defaultScenes) / sizeof(defaultScenes[0]));
+	int frames = 5;
+	double tolerance = -1;
+	const char *csvPath = NULL;
+
+	for (int a = 1; a < argc; a++) {
+		bool hasValue = a + 1 < argc;
+		if (!strcmp(argv[a], "--meshes") && hasValue) {
+			// Scenes of the defaults keep their tolerance, others get that of --tolerance
+			vector<SceneCheck> chosen;
+			for (const string &mesh : parseList(argv[++a])) {
+				SceneCheck scene = { NULL, 0.1, false };
+				for (const SceneCheck &known : defaultScenes) {
+					if (mesh == known.mesh) scene = known;
+				}
+				scene.mesh = strdup(mesh.c_str());
+				chosen.push_back(scene);
+			}
+			scenes = chosen;
+		} else if (!strcmp(argv[a], "--frames") && hasValue) {
+			frames = atoi(argv[++a]);
+		} else if (!strcmp(argv[a], "--tolerance") && hasValue) {
+			tolerance = atof(argv[++a]);
+		} else if (!strcmp(argv[a], "--csv") && hasValue) {
+			csvPath = argv[++a];
+		} else {
+			printUsage();
+			return 2;
+		}
+	}
+	if (tolerance >= 0) {
+		for (SceneCheck &scene : scenes) {
+			scene.tolerance = tolerance;
+		}
+	}
+
+	FILE *out = csvPath ? fopen(csvPath, "wt") : stdout;
+	if (!out) {
+		fprintf(stderr, "cannot open %s\n", csvPath);
+		return 2;
+	}
+	fprintf(out, "scene,particles,frame,rms_distance,max_distance,max_speed_float,max_speed_double\n");
+
+	// Fixed steps, as PBFApp takes them unless the time step is adaptive
+	const SimulationParams &params = ParticleSystemSettings::params;
+	int stepsPerFrame = max(1, (int)(FRAME_TIME / params.deltaT));
+	int failures = 0;
+	for (const SceneCheck &scene : scenes) {
+		BenchmarkCloud cloud = makeMeshCloud(scene.mesh, 0);
+		if (cloud.positions.empty()) {
+			fprintf(stderr, "no particles in %s\n", scene.mesh);
+			return 2;
+		}
+		vector<ParticleInit> particles(cloud.positions.size());
+		for (int i = 0; i < (int)particles.size(); i++) {
+			particles[i].position = cloud.positions[i];
+			particles[i].velocity = V3D(0, 0, 0);
+			particles[i].mass = 1;
+		}
+
+		TrackedSystem<float> single(particles);
+		TrackedSystem<double> reference(particles);
+		double largest = 0, fastest = 0;
+		bool finite = true;
+		for (int frame = 1; frame <= frames; frame++) {
+			double singleSpeed = 0, referenceSpeed = 0;
+			for (int s = 0; s < stepsPerFrame; s++) {
+				singleSpeed = max(singleSpeed, single.step(params.deltaT));
+				referenceSpeed = max(referenceSpeed, reference.step(params.deltaT));
+			}
+
+			double sumSquares = 0, frameLargest = 0;
+			for (int i = 0; i < (int)particles.size(); i++) {
+				double distance = (single.positionOf(i) - reference.positionOf(i)).length() / params.kernelH;
+				sumSquares += distance * distance;
+				frameLargest = max(frameLargest, distance);
+				finite = finite && isfinite(distance);
+			}
+			fprintf(out, "%s,%d,%d,%.6f,%.6f,%.3f,%.3f\n", cloud.name.c_str(), (int)particles.size(), frame,
+				sqrt(sumSquares / particles.size()), frameLargest, singleSpeed, referenceSpeed);
+			fflush(out);
+			largest = max(largest, frameLargest);
+			fastest = max(fastest, max(singleSpeed, referenceSpeed));
+		}
+
+		bool unstable = !finite || !(fastest * params.deltaT <= MAX_STABLE_STEP * params.kernelH);
+		if (unstable && scene.knownUnstable) {
+			fprintf(stderr, "%s: unstable as expected, particles reach %.1f m/s; the runs are not compared\n",
+				cloud.name.c_str(), fastest);
+		} else if (unstable) {
+			fprintf(stderr, "%s: unstable, particles reach %.1f m/s within %d frames\n", cloud.name.c_str(), fastest, frames);
+			failures++;
+		} else if (scene.knownUnstable) {
+			fprintf(stderr, "%s: stable now, give it a tolerance\n", cloud.name.c_str());
+			failures++;
+		} else if (largest > scene.tolerance) {
+			fprintf(stderr, "%s: single and double precision are %.4f kernel radii apart within %d frames, more than %.4f\n",
+				cloud.name.c_str(), largest, frames, scene.tolerance);
+			failures++;
+		}
+	}
+
+	if (out != stdout) {
+		fclose(out);
+	}
+	return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,210 @@
+#include <Utils/TaskGraph.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+struct TaskGraph::Task {
+	std::string name;
+	RangeFunction function;
+	int n;
+	int grain;
+	// 0 for splittable tasks
+	int parts;
+	std::vector<int> successors;
+	int dependencies;
+
+	// State of the current run
+	std::atomic<int> pendingDependencies;
+	// Elements (or parts) that have not been run yet
+	std::atomic<int> remaining;
+	std::atomic<long long> start;
+	std::atomic<long long> busy;
+	std::atomic<int> ranges;
+	std::atomic<int> steals;
+	long long end;
+};
+
+// Nanoseconds on a monotonic clock
+static long long now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+TaskGraph::TaskGraph()
+	: queueCount(0), unfinishedTasks(0), runStart(0), lastRunTime(0) {
+}
+
+TaskGraph::~TaskGraph() {
+}
+
+void TaskGraph::clear() {
+	tasks.clear();
+}
+
+int TaskGraph::addTask(const std::string &name, int n, int grain, RangeFunction f) {
+	std::unique_ptr<Task> task(new Task);
+	task->name = name;
+	task->function = f;
+	task->n = std::max(n, 0);
+	task->grain = std::max(grain, 1);
+	task->parts = 0;
+	task->dependencies = 0;
+	tasks.push_back(std::move(task));
+	return (int)tasks.size() - 1;
+}
+
+int TaskGraph::addPartitionedTask(const std::string &name, int n, int parts, RangeFunction f) {
+	int index = addTask(name, n, 1, f);
+	tasks[index]->parts = std::max(parts, 1);
+	return index;
+}
+
+void TaskGraph::addDependency(int task, int prerequisite) {
+	if (prerequisite < 0) return;
+	tasks[prerequisite]->successors.push_back(task);
+	tasks[task]->dependencies++;
+}
+
+void TaskGraph::run(ThreadPool &pool) {
+	int threads = pool.threadCount();
+	if (threads != queueCount) {
+		queues.reset(new WorkerQueue[threads]);
+		queueCount = threads;
+	}
+	for (int t = 0; t < threads; t++) {
+		queues[t].items.clear();
+		queues[t].busy = 0;
+	}
+	for (std::unique_ptr<Task> &task : tasks) {
+		task->pendingDependencies = task->dependencies;
+		task->remaining = task->parts > 0 ? task->parts : task->n;
+		task->start = -1;
+		task->busy = 0;
+		task->ranges = 0;
+		task->steals = 0;
+		task->end = 0;
+	}
+
+	runStart = now();
+	unfinishedTasks = (int)tasks.size();
+	for (int i = 0; i < (int)tasks.size(); i++) {
+		if (tasks[i]->dependencies == 0) {
+			schedule(0, i);
+		}
+	}
+	pool.run([&](int thread) {
+		work(thread);
+	});
+	long long runEnd = now();
+
+	lastRunTime = (runEnd - runStart) * 1e-6;
+	timings.resize(tasks.size());
+	for (int i = 0; i < (int)tasks.size(); i++) {
+		const Task &task = *tasks[i];
+		TaskTiming &timing = timings[i];
+		timing.name = task.name;
+		timing.start = (task.start < 0 ? task.end : task.start - runStart) * 1e-6;
+		timing.end = task.end * 1e-6;
+		timing.busy = task.busy * 1e-6;
+		timing.ranges = task.ranges;
+		timing.steals = task.steals;
+	}
+	threadBusy.resize(threads);
+	for (int t = 0; t < threads; t++) {
+		threadBusy[t] = queues[t].busy * 1e-6;
+	}
+}
+
+void TaskGraph::work(int thread) {
+	WorkItem item;
+	while (unfinishedTasks > 0) {
+		if (pop(thread, item) || steal(thread, item)) {
+			execute(thread, item);
+		} else {
+			std::this_thread::yield();
+		}
+	}
+}
+
+bool TaskGraph::pop(int thread, WorkItem &item) {
+	WorkerQueue &queue = queues[thread];
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	if (queue.items.empty()) return false;
+	item = queue.items.back();
+	queue.items.pop_back();
+	return true;
+}
+
+bool TaskGraph::steal(int thread, WorkItem &item) {
+	for (int k = 1; k < queueCount; k++) {
+		WorkerQueue &victim = queues[(thread + k) % queueCount];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.items.empty()) {
+			item = victim.items.front();
+			victim.items.pop_front();
+			tasks[item.task]->steals++;
+			return true;
+		}
+	}
+	return false;
+}
+
+void TaskGraph::push(int thread, const WorkItem &item) {
+	WorkerQueue &queue = queues[thread];
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	queue.items.push_back(item);
+}
+
+void TaskGraph::execute(int thread, WorkItem item) {
+	Task &task = *tasks[item.task];
+	if (item.part < 0) {
+		while (item.end - item.begin > task.grain) {
+			int middle = item.begin + (item.end - item.begin) / 2;
+			WorkItem upper = { item.task, middle, item.end, -1 };
+			push(thread, upper);
+			item.end = middle;
+		}
+	}
+
+	long long begin = now();
+	long long unset = -1;
+	task.start.compare_exchange_strong(unset, begin);
+	task.function(item.begin, item.end, item.part < 0 ? thread : item.part);
+	long long end = now();
+	task.busy += end - begin;
+	task.ranges++;
+	queues[thread].busy += end - begin;
+
+	int done = item.part < 0 ? item.end - item.begin : 1;
+	if (task.remaining.fetch_sub(done) == done) {
+		finish(thread, item.task, end);
+	}
+}
+
+// Queues the work of a task whose prerequisites have all finished.
+void TaskGraph::schedule(int thread, int index) {
+	Task &task = *tasks[index];
+	if (task.parts > 0) {
+		// In reverse, so that this thread goes through the parts in order
+		for (int c = task.parts - 1; c >= 0; c--) {
+			WorkItem item = { index, ThreadPool::rangeBegin(c, task.n, task.parts), ThreadPool::rangeBegin(c + 1, task.n, task.parts), c };
+			push(thread, item);
+		}
+	} else if (task.n > 0) {
+		WorkItem item = { index, 0, task.n, -1 };
+		push(thread, item);
+	} else {
+		finish(thread, index, now());
+	}
+}
+
+void TaskGraph::finish(int thread, int index, long long time) {
+	Task &task = *tasks[index];
+	task.end = time - runStart;
+	for (int successor : task.successors) {
+		if (--tasks[successor]->pendingDependencies == 0) {
+			schedule(thread, successor);
+		}
+	}
+	// Only after the successors are queued, so that no thread stops while there is work left
+	unfinishedTasks--;
+}
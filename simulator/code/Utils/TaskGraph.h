@@ -0,0 +1,101 @@
+#pragma once
+
+#include <Utils/ThreadPool.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// When a task of a TaskGraph ran during the last run, in milliseconds since the run started.
+struct TaskTiming {
+	std::string name;
+	// When its first range started and its last range finished
+	double start;
+	double end;
+	// Time spent in its ranges, summed over the threads that ran them
+	double busy;
+	// Ranges it was run as, and how many of those were stolen from another thread's queue
+	int ranges;
+	int steals;
+};
+
+/**
+ * Tasks over index ranges, with dependencies between them, run by the threads of a ThreadPool.
+ * A task becomes ready once all of its prerequisites have finished, and is then pushed onto the
+ * queue of the thread that finished the last of them. Threads take work from the back of their
+ * own queue and, when it is empty, steal from the front of another thread's, so that independent
+ * tasks overlap and a thread that runs out of work helps with whatever is left.
+ *
+ * Splittable tasks are halved as they are taken: the taker pushes back the upper half and goes
+ * on with the lower one until the range is down to the task's grain, which leaves the largest
+ * pieces at the front of the queue for thieves. Partitioned tasks are split into a fixed number
+ * of parts up front instead, for passes whose results depend on how the work is divided.
+ */
+class TaskGraph {
+public:
+	// f(begin, end, index) runs the task over [begin, end). index is the thread running it, or
+	// the part for partitioned tasks.
+	typedef std::function<void(int begin, int end, int index)> RangeFunction;
+
+	TaskGraph();
+	~TaskGraph();
+
+	void clear();
+	int taskCount() const { return (int)tasks.size(); }
+
+	// Adds a task that runs f over [0, n), in ranges halved until they hold at most grain
+	// elements, and returns its index.
+	int addTask(const std::string &name, int n, int grain, RangeFunction f);
+	// Adds a task that runs f once for each of the given number of parts of [0, n), split as
+	// ThreadPool::rangeBegin does, and returns its index.
+	int addPartitionedTask(const std::string &name, int n, int parts, RangeFunction f);
+	// task does not start before prerequisite has finished. A prerequisite of -1 is ignored,
+	// for tasks that are only added in some configurations.
+	void addDependency(int task, int prerequisite);
+
+	// Runs every task on all threads of the pool, and returns when the last one has finished.
+	void run(ThreadPool &pool);
+
+	// Timings of the tasks during the last run, in the order they were added
+	const std::vector<TaskTiming>& taskTimings() const { return timings; }
+	// Time each thread spent running tasks during the last run, and how long the run took
+	// (in milliseconds)
+	const std::vector<double>& threadBusyTimes() const { return threadBusy; }
+	double runTime() const { return lastRunTime; }
+
+private:
+	struct Task;
+	struct WorkItem {
+		int task;
+		int begin;
+		int end;
+		// -1 for a range of a splittable task
+		int part;
+	};
+	struct WorkerQueue {
+		std::mutex mutex;
+		std::deque<WorkItem> items;
+		long long busy;
+	};
+
+	void work(int thread);
+	bool pop(int thread, WorkItem &item);
+	bool steal(int thread, WorkItem &item);
+	void push(int thread, const WorkItem &item);
+	void execute(int thread, WorkItem item);
+	void schedule(int thread, int task);
+	void finish(int thread, int task, long long time);
+
+	std::vector<std::unique_ptr<Task>> tasks;
+	std::unique_ptr<WorkerQueue[]> queues;
+	int queueCount;
+	std::atomic<int> unfinishedTasks;
+	long long runStart;
+
+	std::vector<TaskTiming> timings;
+	std::vector<double> threadBusy;
+	double lastRunTime;
+};
@@ -0,0 +1,99 @@
+#include <Utils/ThreadPool.h>
+#include <algorithm>
+#include <chrono>
+
+// How long a worker keeps polling for the next job before it goes to sleep
+const std::chrono::microseconds WORKER_SPIN_TIME(200);
+
+static thread_local int currentThreadIndex = 0;
+
+ThreadPool::ThreadPool(int threadCount)
+	: jobFunction(NULL), jobArgument(NULL), generation(0), busyWorkers(0), inJob(false), stopping(false) {
+	startWorkers(threadCount > 0 ? threadCount : hardwareThreads());
+}
+
+ThreadPool::~ThreadPool() {
+	stopWorkers();
+}
+
+int ThreadPool::hardwareThreads() {
+	return std::max((int)std::thread::hardware_concurrency(), 1);
+}
+
+int ThreadPool::currentThread() {
+	return currentThreadIndex;
+}
+
+void ThreadPool::setThreadCount(int count) {
+	count = std::max(count, 1);
+	if (count == threadCount()) return;
+	stopWorkers();
+	startWorkers(count);
+}
+
+void ThreadPool::startWorkers(int count) {
+	stopping = false;
+	// Workers may only get to run after the next job has been published, so they are told
+	// which generation they have already seen rather than reading it themselves
+	unsigned int seen = generation;
+	for (int t = 1; t < count; t++) {
+		workers.push_back(std::thread(&ThreadPool::workerLoop, this, t, seen));
+	}
+}
+
+void ThreadPool::stopWorkers() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		generation++;
+	}
+	wake.notify_all();
+	for (std::thread &worker : workers) {
+		worker.join();
+	}
+	workers.clear();
+}
+
+void ThreadPool::workerLoop(int thread, unsigned int seen) {
+	currentThreadIndex = thread;
+	while (true) {
+		std::chrono::steady_clock::time_point spinEnd = std::chrono::steady_clock::now() + WORKER_SPIN_TIME;
+		while (generation == seen && std::chrono::steady_clock::now() < spinEnd) {
+			std::this_thread::yield();
+		}
+		if (generation == seen) {
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&]() { return generation != seen; });
+		}
+		seen = generation;
+
+		if (stopping) return;
+		jobFunction(jobArgument, thread);
+		busyWorkers--;
+	}
+}
+
+void ThreadPool::runJob(JobFunction function, void *job) {
+	bool idle = false;
+	if (workers.empty() || !inJob.compare_exchange_strong(idle, true)) {
+		for (int t = 0; t < threadCount(); t++) {
+			function(job, t);
+		}
+		return;
+	}
+
+	jobFunction = function;
+	jobArgument = job;
+	busyWorkers = (int)workers.size();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		generation++;
+	}
+	wake.notify_all();
+
+	function(job, 0);
+	while (busyWorkers > 0) {
+		std::this_thread::yield();
+	}
+	inJob = false;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Fixed set of worker threads that wait between jobs, so that running a parallel loop costs a
+ * wake-up rather than starting threads. Workers spin for a short while after each job before
+ * going to sleep, which keeps the back-to-back loops of a simulation step cheap.
+ *
+ * Work is scheduled statically: run(f) calls f(t) exactly once on every thread t, the calling
+ * thread being thread 0. forEachRange hands range t to thread t, so anything indexed by the
+ * thread (scratch buffers, partial sums) is also indexed by the range, and results that depend
+ * on how the work was split only depend on the thread count.
+ */
+class ThreadPool {
+public:
+	// threadCount includes the calling thread. 0 uses one thread per hardware thread.
+	explicit ThreadPool(int threadCount = 0);
+	~ThreadPool();
+
+	int threadCount() const { return (int)workers.size() + 1; }
+	// Stops the workers and starts count - 1 new ones. Must not be called from inside a job.
+	void setThreadCount(int count);
+
+	static int hardwareThreads();
+	// Index of the calling thread in the pool running it, or 0 outside of any job.
+	static int currentThread();
+
+	// First index of range t when [0, n) is split into the given number of ranges.
+	static int rangeBegin(int t, int n, int ranges) {
+		return (int)((long long)n * t / ranges);
+	}
+
+	template<typename F>
+	void run(F f) {
+		runJob(&invoke<F>, &f);
+	}
+
+	// Splits [0, n) into threadCount() contiguous ranges and calls f(begin, end, t) for range t
+	// on thread t.
+	template<typename F>
+	void forEachRange(int n, F f) {
+		int ranges = threadCount();
+		run([&](int t) {
+			f(rangeBegin(t, n, ranges), rangeBegin(t + 1, n, ranges), t);
+		});
+	}
+
+	// Calls f(i) for every i in [0, n).
+	template<typename F>
+	void parallelFor(int n, F f) {
+		forEachRange(n, [&](int begin, int end, int) {
+			for (int i = begin; i < end; i++) {
+				f(i);
+			}
+		});
+	}
+
+private:
+	typedef void (*JobFunction)(void *job, int thread);
+
+	template<typename F>
+	static void invoke(void *job, int thread) {
+		(*(F*)job)(thread);
+	}
+
+	// Runs job on every thread and waits for all of them. A job started from inside another
+	// one, or on a pool without workers, runs all of its threads in turn on the caller.
+	void runJob(JobFunction function, void *job);
+	void workerLoop(int thread, unsigned int seen);
+	void startWorkers(int count);
+	void stopWorkers();
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+
+	// The current job, published by bumping generation
+	JobFunction jobFunction;
+	void *jobArgument;
+	std::atomic<unsigned int> generation;
+	// Workers that have not finished the current job yet
+	std::atomic<int> busyWorkers;
+	std::atomic<bool> inJob;
+	std::atomic<bool> stopping;
+};
@@ -12,7 +12,14 @@ do
   o_file=out/`echo $i | sed "s/.cpp/.o/g"`
   objs="$objs $o_file"
   rule="$o_file: $i"
-  build="\$(CC) \$(CC_FLAGS) -c -o $o_file $i\n"
+  # The batched kernels of each instruction set are compiled for it (see Assignment2/KernelBatch.h)
+  case $i in
+    *KernelBatchSSE4.cpp) isa_flags=" -msse4.1" ;;
+    *KernelBatchAVX2.cpp) isa_flags=" -mavx2 -ffp-contract=off" ;;
+    *KernelBatchAVX512.cpp) isa_flags=" -mavx512f -ffp-contract=off" ;;
+    *) isa_flags="" ;;
+  esac
+  build="\$(CC) \$(CC_FLAGS)$isa_flags -c -o $o_file $i\n"
   build_rules="$build_rules\n$rule\n\t$build"
 done
 